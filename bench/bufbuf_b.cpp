@@ -0,0 +1,99 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "bufbuf.hpp"
+#include "latency.hpp"
+
+namespace {
+	using bench::now_ns;
+	using bench::report_percentiles;
+	using buf_t = BufBuf<char[]>;
+
+	/// Producers filling and publishing slots till stopped. Every frame starts with its publish time.
+	struct Producers {
+		buf_t& buf;
+		const size_t slot_bytes;
+		std::atomic<bool> stop{false};
+		std::atomic<uint64_t> published{0};
+		std::vector<std::thread> threads;
+
+		Producers(buf_t& buf, size_t slot_bytes, size_t n): buf(buf), slot_bytes(slot_bytes) {
+			for(size_t i = 0; i < n; ++i){
+				threads.emplace_back([this, i]{
+					auto w = this->buf.getWriteSlot();
+					auto count = uint64_t{0};
+					while(!stop.load(std::memory_order_relaxed)){
+						std::memset(w, int(i), this->slot_bytes);
+						const auto stamp = now_ns();
+						std::memcpy(w, &stamp, sizeof(stamp));
+						w = this->buf.publish(w);
+						++count;
+					}
+					published += count;
+				});
+			}
+		}
+
+		~Producers(){ finish(); }
+
+		/// Stop producers. @return number of frames published
+		auto finish()-> uint64_t {
+			stop = true;
+			for(auto& t: threads){ t.join(); }
+			threads.clear();
+			return published;
+		}
+	};
+} // namespace
+
+
+/// Reader consumes frames as fast as it can, producers publish as fast as they can.
+/// Iteration is one frame read and copied out of the buffer.
+static void bm_bufbuf_throughput(benchmark::State& s){
+	const auto slot_bytes = size_t(s.range(0));
+	const auto nproducers = size_t(s.range(1));
+	buf_t buf(nproducers, slot_bytes);
+	auto out = std::vector<char>(slot_bytes);
+	Producers producers(buf, slot_bytes, nproducers);
+	while(s.KeepRunning()){
+		std::memcpy(out.data(), buf.read(), slot_bytes);
+		benchmark::DoNotOptimize(out.data());
+	}
+	const auto published = producers.finish();
+	s.SetBytesProcessed(int64_t(s.iterations()*slot_bytes));
+	s.counters["publishes"] = benchmark::Counter(double(published), benchmark::Counter::kIsRate);
+}
+
+/// Time from publish to the moment the reader has the frame.
+static void bm_bufbuf_latency(benchmark::State& s){
+	const auto slot_bytes = size_t(s.range(0));
+	const auto nproducers = size_t(s.range(1));
+	buf_t buf(nproducers, slot_bytes);
+	auto samples = std::vector<int64_t>{};
+	Producers producers(buf, slot_bytes, nproducers);
+	while(s.KeepRunning()){
+		const auto r = buf.read();
+		auto stamp = int64_t{};
+		std::memcpy(&stamp, r, sizeof(stamp));
+		samples.push_back(now_ns() - stamp);
+	}
+	producers.finish();
+	report_percentiles(s, samples);
+}
+
+static auto slot_sizes_and_producers(benchmark::internal::Benchmark* b)-> void {
+	for(int slot: {16, 256, 4*1024, 64*1024, 1024*1024, 4*1024*1024}){
+		for(int producers = 1; producers <= 4; producers *= 2){
+			b->Args({slot, producers});
+		}
+	}
+}
+
+BENCHMARK(bm_bufbuf_throughput)->Apply(slot_sizes_and_producers)->UseRealTime();
+BENCHMARK(bm_bufbuf_latency)->Apply(slot_sizes_and_producers)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/// Helpers of benchmarks measuring handoff latency
+namespace bench {
+	/// @return monotonic clock time in ns, comparable between processes
+	inline auto now_ns()-> int64_t {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		          std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	/// Set p50, p99 and p999 counters from latency samples in ns
+	inline auto report_percentiles(benchmark::State& s, std::vector<int64_t>& samples)-> void {
+		if(samples.empty()){
+			return;
+		}
+		std::sort(begin(samples), end(samples));
+		auto at = [&](double q){ return double(samples[size_t(q*double(samples.size() - 1))]); };
+		s.counters["p50_ns"] = at(0.5);
+		s.counters["p99_ns"] = at(0.99);
+		s.counters["p999_ns"] = at(0.999);
+	}
+} // namespace bench
@@ -0,0 +1,75 @@
+#include <benchmark/benchmark.h>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "shmufbuf.hpp"
+#include "latency.hpp"
+
+namespace {
+	using bench::now_ns;
+	using bench::report_percentiles;
+
+	static const char* REQ_PATH = "/shmufbuf_b_req";
+	static const char* ACK_PATH = "/shmufbuf_b_ack";
+} // namespace
+
+
+/// Handoff between processes. Frame goes to a forked process and back through a second buffer,
+/// one handoff latency is half of the round trip. Iteration is one round trip.
+/// Locking is left out: its pop() does not wait for a frame the writer has not yet started, so there is
+/// no handoff to time.
+template<class Sync>
+static void bm_shmufbuf_handoff(benchmark::State& s){
+	using buf_t = ShmufBuf<char[], Sync>;
+	const auto slot_bytes = size_t(s.range(0));
+	auto req = buf_t::create(REQ_PATH, slot_bytes);
+	auto ack = buf_t::create(ACK_PATH, slot_bytes);
+
+	const auto echo = fork();
+	if(echo == 0){
+		auto rd = buf_t::connect(REQ_PATH, slot_bytes);
+		auto wr = buf_t::connect(ACK_PATH, slot_bytes);
+		for(;;){
+			wr.push(rd.pop());
+		}
+	}
+
+	auto frame = std::vector<char>(slot_bytes, 'x');
+	auto samples = std::vector<int64_t>{};
+	while(s.KeepRunning()){
+		const auto start = now_ns();
+		std::memcpy(frame.data(), &start, sizeof(start));
+		req.push(frame.data());
+		auto echoed = int64_t{};
+		std::memcpy(&echoed, ack.pop(), sizeof(echoed));
+		samples.push_back((now_ns() - start)/2);
+		if(echoed != start){
+			s.SkipWithError("stale frame echoed");
+			break;
+		}
+	}
+	kill(echo, SIGKILL);
+	waitpid(echo, nullptr, 0);
+	shm_unlink(REQ_PATH);
+	shm_unlink(ACK_PATH);
+
+	s.SetBytesProcessed(int64_t(2*s.iterations()*slot_bytes));
+	report_percentiles(s, samples);
+}
+
+static auto slot_sizes(benchmark::internal::Benchmark* b)-> void {
+	for(int slot: {16, 256, 4*1024, 64*1024, 1024*1024, 4*1024*1024}){
+		b->Arg(slot);
+	}
+}
+
+BENCHMARK_TEMPLATE(bm_shmufbuf_handoff, shmuf::LockFree)->Apply(slot_sizes)->UseRealTime();
+BENCHMARK_TEMPLATE(bm_shmufbuf_handoff, shmuf::Queue)->Apply(slot_sizes)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+namespace detail {
+	enum { cache_line = 64 };
+
+	/// Value padded to and aligned on cache line boundary, so that neighbours do not share a cache line.
+	template<class T>
+	struct alignas(cache_line) alignas(T) CacheAligned {
+		T value;
+	};
+
+	/// Fixed size array of default constructed values in cache line aligned memory.
+	/// Works for over-aligned types without C++17 aligned new.
+	template<class T>
+	class AlignedArray {
+		struct Free { auto operator()(void* p) const-> void { std::free(p); } };
+	public:
+		explicit AlignedArray(size_t size): ptr(allocate(size)) {
+			try {
+				for(; n < size; ++n){
+					new(data() + n) T();
+				}
+			} catch(...) {
+				destroy();
+				throw;
+			}
+		}
+		AlignedArray(AlignedArray&&) = default;
+		~AlignedArray(){ destroy(); }
+
+		auto data() const-> T* { return static_cast<T*>(ptr.get()); }
+		auto size() const-> size_t { return n; }
+		auto operator[](size_t i) const-> T& { return data()[i]; }
+
+	private:
+		static auto allocate(size_t size)-> void* {
+			void* p = nullptr;
+			if(posix_memalign(&p, std::max(size_t(cache_line), alignof(T)), std::max(size_t(1), size)*sizeof(T)) != 0){
+				throw std::bad_alloc();
+			}
+			return p;
+		}
+		auto destroy()-> void {
+			for(; n > 0 && ptr; --n){
+				data()[n - 1].~T();
+			}
+		}
+	private: // data
+		std::unique_ptr<void, Free> ptr;
+		size_t n = 0; ///< number of constructed values
+	}; // class AlignedArray
+} // namespace detail
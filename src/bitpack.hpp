@@ -1,7 +1,19 @@
 #pragma once
 
+#include <endian.h>
+
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 namespace detail {
 	template<uint8_t val>
@@ -50,7 +62,90 @@ namespace detail {
 		} 
 	}
 
-	///
+	/// @return index of the first occurence of T in Ts, sizeof...(Ts) if there is none
+	template<class T, class... Ts>
+	constexpr auto index_of()-> size_t {
+		constexpr bool same[] = {std::is_same<T, Ts>::value..., false};
+		auto i = size_t{0};
+		while(i < sizeof...(Ts) && !same[i]){
+			++i;
+		}
+		return i;
+	}
+
+	/// Header of a bit layout as big-endian 64-bit words, the first bit of the header is the top bit of words[0].
+	template<size_t nbytes>
+	struct BitWords {
+		enum { size = (nbytes + 7)/8 };
+		uint64_t words[size];
+
+		/// load the header, bytes past its end read as zeros
+		static auto load(const uint8_t* buf)-> BitWords {
+			uint8_t bytes[8*size] = {};
+			std::memcpy(bytes, buf, nbytes);
+			auto r = BitWords{};
+			for(size_t i = 0; i < size; ++i){
+				std::memcpy(&r.words[i], bytes + 8*i, 8);
+				r.words[i] = be64toh(r.words[i]);
+			}
+			return r;
+		}
+
+		/// store the header, bytes past its end are not touched
+		auto store(uint8_t* buf) const-> void {
+			uint8_t bytes[8*size];
+			for(size_t i = 0; i < size; ++i){
+				const auto w = htobe64(words[i]);
+				std::memcpy(bytes + 8*i, &w, 8);
+			}
+			std::memcpy(buf, bytes, nbytes);
+		}
+
+		/// @return value of the bits [begin, end)
+		template<uint16_t begin, uint16_t end>
+		auto get() const-> uint64_t {
+			constexpr auto w = begin/64u, off = begin%64u, n = unsigned(end - begin);
+			if constexpr(off + n <= 64u){
+				return (words[w] << off) >> (64u - n);
+			} else {
+				return ((words[w] << off) | (words[w + 1] >> (64u - off))) >> (64u - n);
+			}
+		}
+
+		/// set the bits [begin, end) to x, other bits are kept
+		template<uint16_t begin, uint16_t end>
+		auto set(uint64_t x)-> void {
+			constexpr auto w = begin/64u, off = begin%64u, n = unsigned(end - begin);
+			assert(x <= (~uint64_t{0} >> (64u - n))); // number fits into designated bits
+			if constexpr(off + n <= 64u){
+				constexpr auto mask = (~uint64_t{0} >> (64u - n)) << (64u - off - n);
+				words[w] = (words[w] & ~mask) | ((x << (64u - off - n)) & mask);
+			} else {
+				constexpr auto nlo = off + n - 64u; // bits falling to the next word
+				constexpr auto mask_hi = ~uint64_t{0} >> off;
+				constexpr auto mask_lo = ~uint64_t{0} >> nlo;
+				words[w] = (words[w] & ~mask_hi) | ((x >> nlo) & mask_hi);
+				words[w + 1] = (words[w + 1] & mask_lo) | (x << (64u - nlo));
+			}
+		}
+
+		/// or x to the bits [begin, end)
+		template<uint16_t begin, uint16_t end>
+		auto or_bits(uint64_t x)-> void {
+			constexpr auto w = begin/64u, off = begin%64u, n = unsigned(end - begin);
+			assert(x <= (~uint64_t{0} >> (64u - n))); // number fits into designated bits
+			if constexpr(off + n <= 64u){
+				words[w] |= x << (64u - off - n);
+			} else {
+				constexpr auto nlo = off + n - 64u; // bits falling to the next word
+				words[w] |= x >> nlo;
+				words[w + 1] |= x << (64u - nlo);
+			}
+		}
+	}; // struct BitWords
+
+	/// Fields covering up to 8 bytes are read and written as a single big-endian word loaded from exactly
+	/// these bytes, so no access goes past the field. Wider ones (unaligned 64-bit fields) go byte by byte.
 	template<class Buf, uint16_t begin, uint16_t end, class Res=Uint_t<end-begin>>
 	struct BitsProxy_{ 
 		const Buf buf;
@@ -63,6 +158,8 @@ namespace detail {
 			if constexpr(samebyte<begin, end>()){ // begin and end are in the same byte
 				constexpr auto mask = (1u << (end - begin)) - 1u;
 				return (*b0 >> (8 - end%8)) & mask;
+			} else if constexpr(wordwise){
+				return Res(Word::load(b0).template get<begin%8, end - begin/8*8>());
 			} else {
 				Res r = (begin%8 == 0 ? *b0 : (*b0) & (255u >> begin%8));
 				
@@ -85,6 +182,10 @@ namespace detail {
 			assert(x <= (Res(-1) >> (8*sizeof(Res) - (end - begin)))); // number fits into designated bits
 			if constexpr(samebyte<begin, end>()){ // begin and end are in the same byte
 				buf[begin/8] |= uint8_t(x) << (8 - end%8);
+			} else if constexpr(wordwise){
+				auto w = Word::load(buf + begin/8);
+				w.template or_bits<begin%8, end - begin/8*8>(x);
+				w.store(buf + begin/8);
 			} else {
 				auto b0 = buf + (end + 7)/8; // end of the next byte to write
 				if constexpr(end%8 != 0){    // write the last bits not making a complete byte
@@ -108,6 +209,10 @@ namespace detail {
 			if constexpr(samebyte<begin, end>()){ // begin and end are in the same byte
 				buf[begin/8] &= (255u << (8 - begin%8)) | (255u >> end%8);
 				buf[begin/8] |= uint8_t(x) << (8 - end%8);
+			} else if constexpr(wordwise){
+				auto w = Word::load(buf + begin/8);
+				w.template set<begin%8, end - begin/8*8>(x);
+				w.store(buf + begin/8);
 			} else {
 				auto b0 = buf + (end + 7)/8; // end of the next byte to write
 				if constexpr(end%8 != 0){    // write the last bits not making a complete byte
@@ -129,6 +234,10 @@ namespace detail {
 		///
 		template<class T>
 		friend auto operator== (BitsProxy_ x, T val)-> bool { return Res(x) == val; }
+
+	private:
+		using Word = BitWords<(end + 7)/8 - begin/8>; ///< bytes covered by the bits range
+		static constexpr bool wordwise = Word::size == 1;
 	}; // struct BitsProxy_
 	
 	template<uint16_t begin, uint16_t end>
@@ -151,3 +260,423 @@ auto bits(uint8_t* buf) {
 	constexpr auto cboff = T::Begin/8;
 	return detail::BitsProxy<T::Begin - 8*cboff, T::End - 8*cboff>{buf + cboff};
 }
+
+namespace detail {
+	/// bits<F>() of n records, stride bytes apart, one by one
+	template<class F>
+	auto bits_batch_scalar(const uint8_t* recs, size_t stride, size_t n, Uint_t<F::End - F::Begin>* out)-> void {
+		for(size_t i = 0; i < n; ++i){
+			out[i] = bits<F>(recs + i*stride);
+		}
+	}
+
+#if defined(__x86_64__)
+	/// true if the field is within 8 bytes, so that a single 64-bit load per record gets it
+	template<class F>
+	constexpr auto fits_word()-> bool { return (F::End + 7)/8 - F::Begin/8 <= 8; }
+
+	inline auto has_avx2()-> bool { static const bool r = __builtin_cpu_supports("avx2"); return r; }
+	inline auto has_sse41()-> bool { static const bool r = __builtin_cpu_supports("sse4.1"); return r; }
+
+	/// swap bytes of 64-bit lanes
+	__attribute__((target("avx2")))
+	inline auto bswap64_avx2(__m256i v)-> __m256i {
+		return _mm256_shuffle_epi8(v, _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+		                                             , 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8));
+	}
+
+	/// store the 4 64-bit lanes to out narrowing them to T
+	template<class T>
+	__attribute__((target("avx2")))
+	auto store4_avx2(T* out, __m256i v)-> void {
+		if constexpr(sizeof(T) == 8){
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+		} else if constexpr(sizeof(T) == 4){
+			v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(v));
+		} else {
+			alignas(32) uint64_t vals[4];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(vals), v);
+			for(size_t k = 0; k < 4; ++k){
+				out[k] = T(vals[k]);
+			}
+		}
+	}
+
+	/// Vector version of bits_batch_scalar() taking 4 records at a time with a gather.
+	/// Only loads 8 bytes past the field start that lie within the n records.
+	/// @return number of records done, the rest is left for the scalar version
+	template<class F>
+	__attribute__((target("avx2")))
+	auto bits_batch_avx2(const uint8_t* recs, size_t stride, size_t n, Uint_t<F::End - F::Begin>* out)-> size_t {
+		constexpr auto byteoff = F::Begin/8u, off = F::Begin%8u, nbits = unsigned(F::End - F::Begin);
+		const auto idx = _mm256_setr_epi64x(0, (long long)stride, 2*(long long)stride, 3*(long long)stride);
+		const auto total = n*stride;
+		auto i = size_t{0};
+		for(; i + 4 <= n && (i + 3)*stride + byteoff + 8 <= total; i += 4){
+			const auto base = reinterpret_cast<const long long*>(recs + i*stride + byteoff);
+			const auto v = bswap64_avx2(_mm256_i64gather_epi64(base, idx, 1));
+			store4_avx2(out + i, _mm256_srli_epi64(_mm256_slli_epi64(v, off), 64 - nbits));
+		}
+		return i;
+	}
+
+	/// Same as bits_batch_avx2() with 2 records at a time
+	template<class F>
+	__attribute__((target("sse4.1")))
+	auto bits_batch_sse41(const uint8_t* recs, size_t stride, size_t n, Uint_t<F::End - F::Begin>* out)-> size_t {
+		constexpr auto byteoff = F::Begin/8u, off = F::Begin%8u, nbits = unsigned(F::End - F::Begin);
+		const auto bswap = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+		const auto total = n*stride;
+		auto i = size_t{0};
+		for(; i + 2 <= n && (i + 1)*stride + byteoff + 8 <= total; i += 2){
+			const auto p = recs + i*stride + byteoff;
+			auto hi = int64_t{};
+			std::memcpy(&hi, p + stride, 8);
+			auto v = _mm_insert_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), hi, 1);
+			v = _mm_shuffle_epi8(v, bswap);
+			v = _mm_srli_epi64(_mm_slli_epi64(v, off), 64 - nbits);
+			if constexpr(sizeof(*out) == 8){
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+			} else {
+				out[i] = Uint_t<F::End - F::Begin>(_mm_cvtsi128_si64(v));
+				out[i + 1] = Uint_t<F::End - F::Begin>(_mm_extract_epi64(v, 1));
+			}
+		}
+		return i;
+	}
+#endif // __x86_64__
+} // namespace detail
+
+/// Extract the field F from n records, stride bytes apart, to out.
+/// Goes through AVX2 or SSE4.1 when the CPU has them and the field is within 8 bytes, otherwise record by record.
+template<class F>
+auto bits_batch(const uint8_t* recs, size_t stride, size_t n, detail::Uint_t<F::End - F::Begin>* out)-> void {
+	auto done = size_t{0};
+#if defined(__x86_64__)
+	if constexpr(detail::fits_word<F>()){
+		if(detail::has_avx2()){
+			done = detail::bits_batch_avx2<F>(recs, stride, n, out);
+		} else if(detail::has_sse41()){
+			done = detail::bits_batch_sse41<F>(recs, stride, n, out);
+		}
+	}
+#endif
+	detail::bits_batch_scalar<F>(recs + done*stride, stride, n - done, out + done);
+}
+
+/// Layout of a header made of the given Bits<> fields, all decoded or encoded at once.
+/// The header is loaded as big-endian 64-bit words and each field is taken by a shift and a mask,
+/// instead of reading overlapping bytes again for every field as bits<>() does.
+/// Values are kept in a tuple, field i having the type bits<>() would give it.
+template<class... Fields>
+struct BitLayout {
+	using Values = std::tuple<detail::Uint_t<Fields::End - Fields::Begin>...>;
+	enum { End = std::max({uint16_t(Fields::End)...}), Bytes = (End + 7)/8 };
+	static_assert(((Fields::End - Fields::Begin <= 64) && ...), "field does not fit 64 bits");
+
+	/// @return values of all fields of the header in buf
+	static auto unpack(const uint8_t* buf)-> Values {
+		const auto w = Words::load(buf);
+		return Values{w.template get<Fields::Begin, Fields::End>()...};
+	}
+
+	/// Columns to extract fields of many headers to, one array per field
+	using Columns = std::tuple<detail::Uint_t<Fields::End - Fields::Begin>*...>;
+
+	/// Extract all fields of n headers, stride bytes apart, a column at a time.
+	/// Element i of column k gets the value of field k of header i.
+	static auto unpack_batch(const uint8_t* recs, size_t stride, size_t n, const Columns& cols)-> void {
+		unpack_batch_(recs, stride, n, cols, std::index_sequence_for<Fields...>{});
+	}
+
+	/// Write all fields to the header in buf. Bits not covered by fields keep their values.
+	static auto pack(uint8_t* buf, const Values& vals)-> void {
+		auto w = Words::load(buf);
+		pack_(w, vals, std::index_sequence_for<Fields...>{});
+		w.store(buf);
+	}
+
+	/// @return value of the field F
+	template<class F>
+	static auto get(const Values& vals)-> const auto& {
+		return std::get<detail::index_of<F, Fields...>()>(vals);
+	}
+
+	template<class F>
+	static auto get(Values& vals)-> auto& {
+		return std::get<detail::index_of<F, Fields...>()>(vals);
+	}
+
+private:
+	using Words = detail::BitWords<Bytes>;
+
+	template<size_t... Is>
+	static auto unpack_batch_(const uint8_t* recs, size_t stride, size_t n, const Columns& cols
+	                          , std::index_sequence<Is...>)-> void
+	{
+		(bits_batch<Fields>(recs, stride, n, std::get<Is>(cols)), ...);
+	}
+
+	template<size_t... Is>
+	static auto pack_(Words& w, const Values& vals, std::index_sequence<Is...>)-> void {
+		(w.template set<Fields::Begin, Fields::End>(std::get<Is>(vals)), ...);
+	}
+}; // struct BitLayout
+
+namespace detail {
+	/// @return 8 bytes at p as a big-endian number
+	inline auto load_be64(const uint8_t* p)-> uint64_t {
+		auto r = uint64_t{};
+		std::memcpy(&r, p, 8);
+		return be64toh(r);
+	}
+
+	/// store x to 8 bytes at p in big-endian order
+	inline auto store_be64(uint8_t* p, uint64_t x)-> void {
+		x = htobe64(x);
+		std::memcpy(p, &x, 8);
+	}
+
+#if defined(__x86_64__)
+	/// Unpack values [first, first + n) of a PackedArray<nbits> 4 at a time with a gather and per-lane shifts.
+	/// @return number of values done, the rest is left for the scalar version
+	template<uint8_t nbits, class T>
+	__attribute__((target("avx2")))
+	auto packed_unpack_avx2(const uint8_t* data, size_t first, size_t n, T* out)-> size_t {
+		const auto step = _mm256_set1_epi64x(4*nbits);
+		const auto seven = _mm256_set1_epi64x(7);
+		const auto pos0 = static_cast<long long>(first*nbits);
+		auto pos = _mm256_setr_epi64x(pos0, pos0 + nbits, pos0 + 2*nbits, pos0 + 3*nbits);
+		auto i = size_t{0};
+		for(; i + 4 <= n; i += 4){
+			const auto base = reinterpret_cast<const long long*>(data);
+			const auto v = bswap64_avx2(_mm256_i64gather_epi64(base, _mm256_srli_epi64(pos, 3), 1));
+			store4_avx2(out + i, _mm256_srli_epi64(_mm256_sllv_epi64(v, _mm256_and_si256(pos, seven)), 64 - nbits));
+			pos = _mm256_add_epi64(pos, step);
+		}
+		return i;
+	}
+#endif // __x86_64__
+} // namespace detail
+
+/// Array of unsigned numbers taking nbits bits each, packed back to back in big-endian (network) order.
+/// Value i occupies the bits [i*nbits, (i + 1)*nbits) of data(), same as Bits<i*nbits, (i + 1)*nbits> would.
+/// Storage has 8 bytes of slack at the end, so that any value is accessed by a single 64-bit load.
+template<uint8_t nbits>
+class PackedArray {
+	static_assert(nbits > 0 && nbits <= 57, "value with its offset in a byte must fit 64 bits");
+public:
+	using value_type = detail::Uint_t<nbits>;
+
+	/// Reference to a value in the array
+	class Proxy {
+	public:
+		operator value_type() const { return arr.get(i); }
+		auto operator= (value_type x)-> Proxy& { arr.set(i, x); return *this; }
+		auto operator= (const Proxy& other)-> Proxy& { return *this = value_type(other); }
+	private:
+		friend class PackedArray;
+		Proxy(PackedArray& arr, size_t i): arr(arr), i(i) {}
+		PackedArray& arr;
+		size_t i;
+	}; // class Proxy
+
+	/// array of n zeros
+	explicit PackedArray(size_t n=0): n(n), buf(n*nbits/8 + 9, 0u) {}
+
+	auto size() const-> size_t { return n; }
+
+	/// packed values, (size()*nbits + 7)/8 bytes
+	auto data() const-> const uint8_t* { return buf.data(); }
+	auto data()-> uint8_t* { return buf.data(); }
+
+	auto operator[](size_t i) const-> value_type { return get(i); }
+	auto operator[](size_t i)-> Proxy { return Proxy(*this, i); }
+
+	auto get(size_t i) const-> value_type {
+		assert(i < n);
+		const auto pos = i*nbits;
+		return value_type((detail::load_be64(&buf[pos/8]) << pos%8) >> (64u - nbits));
+	}
+
+	auto set(size_t i, value_type x)-> void {
+		assert(i < n);
+		assert(x <= (~uint64_t{0} >> (64u - nbits))); // number fits into designated bits
+		const auto pos = i*nbits;
+		const auto shift = 64u - nbits - pos%8;
+		const auto mask = (~uint64_t{0} >> (64u - nbits)) << shift;
+		const auto w = detail::load_be64(&buf[pos/8]);
+		detail::store_be64(&buf[pos/8], (w & ~mask) | (uint64_t(x) << shift));
+	}
+
+	/// Copy values [first, first + count) to out. Uses AVX2 when the CPU has it.
+	auto unpack(size_t first, size_t count, value_type* out) const-> void {
+		assert(first + count <= n);
+		auto done = size_t{0};
+#if defined(__x86_64__)
+		if(detail::has_avx2()){
+			done = detail::packed_unpack_avx2<nbits>(buf.data(), first, count, out);
+		}
+#endif
+		for(auto i = done; i < count; ++i){
+			out[i] = get(first + i);
+		}
+	}
+
+	/// Copy count values from src to [first, first + count).
+	/// Values are streamed through a 64-bit accumulator and written out a byte at a time,
+	/// only the partial bytes at both ends are merged with their neighbours.
+	auto pack(size_t first, size_t count, const value_type* src)-> void {
+		assert(first + count <= n);
+		auto i = size_t{0};
+		for(; i < count && (first + i)%8 != 0; ++i){ // up to a value starting at byte boundary
+			set(first + i, src[i]);
+		}
+		auto out = &buf[(first + i)*nbits/8];
+		auto acc = uint64_t{0};
+		auto nacc = 0u; // bits in the accumulator, always < 8 between the values
+		for(; i < count; ++i){
+			assert(src[i] <= (~uint64_t{0} >> (64u - nbits))); // number fits into designated bits
+			acc = (acc << nbits) | src[i];
+			nacc += nbits;
+			while(nacc >= 8){
+				nacc -= 8;
+				*out++ = uint8_t(acc >> nacc);
+			}
+		}
+		if(nacc != 0){
+			const auto keep = uint8_t(255u >> nacc);
+			*out = uint8_t((*out & keep) | (acc << (8 - nacc)));
+		}
+	}
+private: // data
+	size_t n;                 ///< number of values
+	std::vector<uint8_t> buf; ///< packed values and 8 bytes of slack
+}; // class PackedArray
+
+/// Sequential reading of bit fields of runtime widths in the order of bits<>().
+/// Bits come from a 64-bit buffer refilled a word at a time, the last 7 bytes are taken one by one.
+class BitReader {
+public:
+	BitReader(const uint8_t* buf, size_t size): begin(buf), cur(buf), end(buf + size) {}
+
+	/// @return next nbits bits as a number, nbits <= 64
+	auto read(unsigned nbits)-> uint64_t {
+		assert(nbits <= bits_left());
+		if(nbits > 56){
+			const auto hi = read(nbits - 32);
+			return (hi << 32) | read(32);
+		}
+		if(nbits == 0){
+			return 0;
+		}
+		if(nacc < nbits){
+			refill();
+		}
+		const auto r = acc >> (64u - nbits);
+		acc <<= nbits;
+		nacc -= nbits;
+		return r;
+	}
+
+	/// skip nbits bits
+	auto skip(size_t nbits)-> void {
+		for(; nbits > 56; nbits -= 56){
+			read(56);
+		}
+		read(unsigned(nbits));
+	}
+
+	/// @return number of bits read so far
+	auto position() const-> size_t { return size_t(cur - begin)*8u - nacc; }
+
+	auto bits_left() const-> size_t { return size_t(end - cur)*8u + nacc; }
+
+private:
+	/// top up the bit buffer to at least 57 bits or till the end of data
+	auto refill()-> void {
+		if(end - cur >= 8){
+			acc |= detail::load_be64(cur) >> nacc;
+			const auto nbytes = (63u - nacc)/8u;
+			cur += nbytes;
+			nacc += 8u*nbytes;
+		} else {
+			for(; nacc <= 56u && cur != end; nacc += 8u){
+				acc |= uint64_t(*cur++) << (56u - nacc);
+			}
+		}
+	}
+private: // data
+	const uint8_t* begin;
+	const uint8_t* cur;   ///< next byte to get to the bit buffer
+	const uint8_t* end;
+	uint64_t acc = 0;     ///< bit buffer, next bit to read is the top one
+	unsigned nacc = 0;    ///< number of bits in the buffer
+}; // class BitReader
+
+/// Sequential writing of bit fields of runtime widths in the order of bits<>().
+/// Bits gather in a 64-bit buffer which goes to memory a word at a time. Like BitsProxy_::operator=,
+/// it does not change the bits it was not asked to write. Pending bits are written by flush() and on destruction.
+class BitWriter {
+public:
+	BitWriter(uint8_t* buf, size_t size): begin(buf), cur(buf), end(buf + size) {}
+	BitWriter(const BitWriter&) = delete;
+	auto operator=(const BitWriter&)-> BitWriter& = delete;
+	~BitWriter(){ flush(); }
+
+	/// write the lower nbits bits of x, nbits <= 64
+	auto write(uint64_t x, unsigned nbits)-> void {
+		assert(nbits <= bits_left());
+		assert(nbits == 64 || x >> nbits == 0); // number fits into designated bits
+		if(nbits > 56){
+			write(x >> 32, nbits - 32);
+			write(x & 0xffffffffu, 32);
+			return;
+		}
+		if(nbits == 0){
+			return;
+		}
+		if(nacc + nbits > 64u){
+			drain();
+		}
+		acc |= x << (64u - nacc - nbits);
+		nacc += nbits;
+	}
+
+	/// Write out the pending bits. Last incomplete byte is merged with the bits following it.
+	auto flush()-> void {
+		drain();
+		if(nacc != 0){
+			*cur = uint8_t((*cur & (255u >> nacc)) | (acc >> 56));
+		}
+	}
+
+	/// @return number of bits written so far
+	auto position() const-> size_t { return size_t(cur - begin)*8u + nacc; }
+
+	auto bits_left() const-> size_t { return size_t(end - cur)*8u - nacc; }
+
+private:
+	/// move complete bytes from the bit buffer to memory
+	auto drain()-> void {
+		const auto nbytes = nacc/8u;
+		if(end - cur >= 8){
+			const auto keep = nacc == 64u ? uint64_t{0} : ~uint64_t{0} >> nacc; // bits not written yet
+			detail::store_be64(cur, acc | (detail::load_be64(cur) & keep));
+		} else {
+			for(unsigned i = 0; i < nbytes; ++i){
+				cur[i] = uint8_t(acc >> (56u - 8u*i));
+			}
+		}
+		cur += nbytes;
+		acc = nbytes == 8u ? 0u : acc << 8u*nbytes;
+		nacc -= 8u*nbytes;
+	}
+private: // data
+	uint8_t* begin;
+	uint8_t* cur;         ///< byte the top of the bit buffer goes to
+	uint8_t* end;
+	uint64_t acc = 0;     ///< bit buffer, first pending bit is the top one
+	unsigned nacc = 0;    ///< number of bits in the buffer
+}; // class BitWriter
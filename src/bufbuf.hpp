@@ -1,124 +1,899 @@
 #pragma once
 
+#include "aligned.hpp"
+#include "executor.hpp"
+#include "futex.hpp"
+
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
 #include <cassert>
-#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <stdexcept>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
-/// Thread-safe multiple writers single reader circular pop-the-last buffer.
-template <class T> class BufBuf;
+/// Writers policy of BufBuf. Any number of threads, each owning a writing slot.
+struct MultiProducer {};
+
+/// Writers policy of BufBuf. Exactly one writing thread. Turns the buffer into a wait-free triple buffer.
+struct SingleProducer {};
+
+/// What lossless BufBuf does with a new frame when its queue is full.
+enum class Overflow {
+	block,       ///< publish() waits till the reader makes room
+	fail,        ///< publish() throws, try_publish() returns false
+	drop_oldest  ///< the oldest unread frame is dropped to make room
+};
+
+/// Writers policy of BufBuf. Any number of threads. Published frames are queued in a bounded ring
+/// and none is lost, unless overflow policy says so.
+template<Overflow overflow=Overflow::block>
+struct Lossless {};
+
+/// Statistics policy of BufBuf. Records nothing and compiles to nothing.
+struct NoStats {
+	static auto now()-> int64_t { return 0; }
+	auto init(size_t /*nslots*/)-> void {}
+	auto count_publish(size_t /*slot*/)-> void {}
+	auto count_read(size_t /*slot*/)-> void {}
+	auto count_overwrite()-> void {}
+	auto count_contention()-> void {}
+	auto count_wait(int64_t /*ns*/)-> void {}
+};
+
+/// Statistics policy of BufBuf. Counts events with relaxed atomics, stats() of the buffer gives a Snapshot.
+/// Publish to read latency is measured by timestamping every published slot.
+class Stats {
+public:
+	enum { latency_buckets = 32 };
+
+	struct Snapshot {
+		uint64_t publishes;    ///< frames published
+		uint64_t reads;        ///< frames read
+		uint64_t overwritten;  ///< frames overwritten or dropped before the reader saw them
+		uint64_t empty_waits;  ///< blocking reads that had to wait for data
+		uint64_t wait_ns;      ///< total time spent waiting in blocking reads
+		uint64_t contention;   ///< failed CAS attempts on the shared state, i.e. threads getting in each other's way
+		std::array<uint64_t, latency_buckets> latency; ///< bucket i counts reads [2^i, 2^(i+1)) ns after publish
+	};
+
+	/// @return steady clock time in ns
+	static auto now()-> int64_t {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		          std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	auto init(size_t nslots)-> void { stamps.reset(new std::atomic<int64_t>[nslots]()); }
+
+	/// Call before slot is published, so that its timestamp is published with it
+	auto count_publish(size_t slot)-> void {
+		stamps[slot].store(now(), std::memory_order_relaxed);
+		publishes.fetch_add(1, std::memory_order_relaxed);
+	}
+	auto count_read(size_t slot)-> void {
+		const auto dt = uint64_t(std::max(int64_t(1), now() - stamps[slot].load(std::memory_order_relaxed)));
+		const auto bucket = std::min(size_t(latency_buckets - 1), size_t(63 - __builtin_clzll(dt)));
+		latency[bucket].fetch_add(1, std::memory_order_relaxed);
+		reads.fetch_add(1, std::memory_order_relaxed);
+	}
+	auto count_overwrite()-> void { overwritten.fetch_add(1, std::memory_order_relaxed); }
+	auto count_contention()-> void { contention.fetch_add(1, std::memory_order_relaxed); }
+	auto count_wait(int64_t ns)-> void {
+		empty_waits.fetch_add(1, std::memory_order_relaxed);
+		wait_ns.fetch_add(uint64_t(ns), std::memory_order_relaxed);
+	}
+
+	auto snapshot() const-> Snapshot {
+		auto r = Snapshot{publishes.load(), reads.load(), overwritten.load(), empty_waits.load(), wait_ns.load()
+		                  , contention.load(), {}};
+		for(size_t i = 0; i < latency_buckets; ++i){
+			r.latency[i] = latency[i].load();
+		}
+		return r;
+	}
+private: // data, writer side and reader side counters on separate cache lines
+	std::unique_ptr<std::atomic<int64_t>[]> stamps; ///< publish time of every slot
+	alignas(detail::cache_line) std::atomic<uint64_t> publishes{0};
+	std::atomic<uint64_t> overwritten{0};
+	std::atomic<uint64_t> contention{0};
+	alignas(detail::cache_line) std::atomic<uint64_t> reads{0};
+	std::atomic<uint64_t> empty_waits{0};
+	std::atomic<uint64_t> wait_ns{0};
+	std::array<std::atomic<uint64_t>, latency_buckets> latency{};
+}; // class Stats
+
+namespace detail {
+	/// State of the pop-the-last buffer packed in one futex word.
+	/// Holds the slot being read, the spare slot and a flag telling that the spare slot is published and unread.
+	/// Spare slot is taken by publish() in exchange for the published one, and by read in exchange for the read one.
+	struct BufBufState {
+		enum: uint32_t { idx_bits = 15, idx_mask = (1u << idx_bits) - 1, fresh = 1u << 31 };
+		static constexpr size_t max_slots = idx_mask + 1;
+
+		static auto pack(uint32_t cur, uint32_t next, bool is_fresh)-> uint32_t {
+			return cur | next << idx_bits | (is_fresh ? uint32_t(fresh) : 0u);
+		}
+		static auto cur(uint32_t state)-> uint32_t { return state & idx_mask; }
+		static auto next(uint32_t state)-> uint32_t { return state >> idx_bits & idx_mask; }
+		static auto is_fresh(uint32_t state)-> bool { return state & fresh; }
+	};
+
+	constexpr auto gcd(size_t a, size_t b)-> size_t { return b == 0 ? a : gcd(b, a % b); }
+
+	/// @return number of elements of type T in a slot of given size padded to whole cache lines
+	template<class T>
+	constexpr auto padded_slot_size(size_t slotsize)-> size_t {
+		const auto line = cache_line/gcd(sizeof(T), cache_line); // shortest run of T's spanning whole cache lines
+		return (slotsize + line - 1)/line*line;
+	}
+
+	/// Growable slot storage. Segments are added as needed and never move, so slot pointers stay valid.
+	/// First segment holds a power of 2 number of slots, every next one doubles the capacity.
+	/// Each slot is per_slot values of type U.
+	template<class U>
+	class BufBufStorage {
+		enum { max_segments = 24 };
+	public:
+		BufBufStorage(size_t nslots, size_t per_slot): first_bits(ceil_log2(nslots)), per_slot(per_slot) {
+			reserve(nslots);
+		}
+
+		/// Make sure there is room for nslots slots. Thread-safe.
+		auto reserve(size_t nslots)-> void {
+			std::lock_guard<std::mutex> lck(m);
+			for(auto cap = capacity(); cap < nslots; cap = capacity()){
+				if(owned.size() == max_segments){
+					throw std::bad_alloc();
+				}
+				const auto seg_slots = owned.empty() ? size_t(1) << first_bits : cap;
+				owned.emplace_back(new AlignedArray<U>(seg_slots*per_slot));
+				segs[owned.size() - 1].store(owned.back()->data(), std::memory_order_release);
+			}
+		}
+
+		/// @return first value of the slot. Slot must be reserved and its id obtained in sync with reserve().
+		auto slot(size_t id) const-> U* {
+			if(id >> first_bits == 0){
+				return segs[0].load(std::memory_order_acquire) + id*per_slot;
+			}
+			const auto top = floor_log2(id);
+			return segs[top - first_bits + 1].load(std::memory_order_acquire) + (id - (size_t(1) << top))*per_slot;
+		}
+
+		/// @return id of the slot starting at p
+		auto id_of(const U* p) const-> size_t {
+			for(size_t k = 0;; ++k){
+				const auto seg = segs[k].load(std::memory_order_acquire);
+				const auto base = k == 0 ? size_t(0) : size_t(1) << (first_bits + k - 1);
+				const auto seg_slots = k == 0 ? size_t(1) << first_bits : base;
+				if(seg <= p && p < seg + seg_slots*per_slot){
+					return base + size_t(p - seg)/per_slot;
+				}
+			}
+		}
+	private:
+		static auto floor_log2(size_t n)-> size_t { return sizeof(unsigned long long)*8 - 1 - size_t(__builtin_clzll(n)); }
+		static auto ceil_log2(size_t n)-> size_t { return n <= 1 ? 0 : floor_log2(n - 1) + 1; }
+		auto capacity() const-> size_t { return owned.empty() ? 0 : size_t(1) << (first_bits + owned.size() - 1); }
+	private: // data
+		const size_t first_bits;  ///< log2 of the number of slots in the first segment
+		const size_t per_slot;    ///< number of values in one slot
+		std::array<std::atomic<U*>, max_segments> segs{}; ///< segment addresses, read lock-free
+		std::mutex m;             ///< guards growth
+		std::vector<std::unique_ptr<AlignedArray<U>>> owned;
+	}; // class BufBufStorage
+
+	/// Lets an event loop learn about publishes. Holds an eventfd to signal on every publish, -1 for none.
+	class PublishHook {
+	public:
+		auto set(int fd)-> void { evfd.store(fd); }
+		auto fire() const-> void {
+			const auto fd = evfd.load();
+			if(fd != -1){
+				const auto one = uint64_t{1};
+				(void)!write(fd, &one, sizeof(one));
+			}
+		}
+	private: // data
+		std::atomic<int> evfd{-1};
+	}; // class PublishHook
+
+	/// Writing slot of BufBuf owned by one producer. Gives the slot back to the buffer on destruction,
+	/// so producers may come and go without exhausting the buffer.
+	template<class Buf>
+	class BufBufWriter {
+	public:
+		BufBufWriter(Buf& buf, uint32_t id): buf(&buf), id(id) {}
+		BufBufWriter(BufBufWriter&& other) noexcept: buf(other.buf), id(other.id) { other.buf = nullptr; }
+		BufBufWriter(const BufBufWriter&) = delete;
+		~BufBufWriter(){
+			if(buf){
+				buf->sync.release_writer(id);
+			}
+		}
+
+		/// @return slot open for writing
+		auto slot() const-> decltype(auto) { return buf->at(id); }
+
+		/// Publishes the slot for reading.
+		/// @return next slot open for writing
+		auto publish()-> decltype(auto) {
+			id = buf->publish_id(id);
+			return slot();
+		}
+	private: // data
+		Buf* buf;
+		uint32_t id; ///< slot currently owned
+	}; // class BufBufWriter
+
+	/// Slot handoff of BufBuf, in terms of slot indexes. Storage is up to BufBuf.
+	/// Reader and writer owned parts are kept on separate cache lines.
+	template<class Producers> class BufBufSync;
+
+	/// Lock-free handoff between many writers and one reader.
+	/// Slots 0 and 1 are initially held by reader and spare, the rest by writers.
+	template<>
+	class BufBufSync<MultiProducer> {
+		using State = BufBufState;
+	public:
+		static constexpr uint32_t none = ~0u;
+
+		/// Sync for given number of writers, up to max_nwriters may be registered later (0 for no growth)
+		BufBufSync(size_t nwriters, size_t max_nwriters)
+		   : nslots(nwriters + 2), max_nslots(std::max(nwriters, max_nwriters) + 2), state(State::pack(0, 1, false))
+		{
+			if(max_nslots > State::max_slots){
+				throw std::runtime_error("too many writing slots");
+			}
+		}
+
+		/// @return slot to read or none if buffer is empty
+		template<class Stats=NoStats>
+		auto try_read(Stats&& stats=Stats{})-> uint32_t {
+			auto s = state.load();
+			for(;;){
+				if(!State::is_fresh(s)){
+					return none;
+				}
+				if(state.compare_exchange_weak(s, State::pack(State::next(s), State::cur(s), false))){
+					return State::next(s);
+				}
+				stats.count_contention();
+			}
+		}
+
+		/// Sleep till ready() returns something truthy, which is then returned.
+		template<class F>
+		auto await(F ready)-> decltype(ready()) { return detail::futex_await(state, waiters, false, ready); }
+
+		/// @return next slot to write to
+		template<class Stats=NoStats>
+		auto publish(uint32_t id, Stats&& stats=Stats{})-> uint32_t {
+			auto s = state.load();
+			while(!state.compare_exchange_weak(s, State::pack(State::cur(s), id, true))){
+				stats.count_contention();
+			}
+			assert(id != State::cur(s)); // publish event to the slot currently being read
+			if(State::is_fresh(s)){
+				stats.count_overwrite();
+			} else if(waiters.load() != 0){
+				detail::futex_wake(state, false, 1);
+			}
+			return State::next(s);
+		}
+
+		/// @return slot of a new writer or none if all are taken.
+		/// Slots given back by gone writers are reused first.
+		auto take_writer()-> uint32_t {
+			std::lock_guard<std::mutex> lck(m);
+			if(!free.empty()){
+				const auto r = free.back();
+				free.pop_back();
+				return r;
+			}
+			if(nwriters + 2 == max_nslots){
+				return none;
+			}
+			return uint32_t(2 + nwriters++);
+		}
+
+		/// Give back slot currently owned by a writer
+		auto release_writer(uint32_t id)-> void {
+			std::lock_guard<std::mutex> lck(m);
+			free.push_back(id);
+		}
+
+		const size_t nslots;      ///< initial number of slots
+		const size_t max_nslots;  ///< number of slots the buffer may grow to
+	private: // data
+		alignas(cache_line) std::atomic<uint32_t> state; ///< packed State. Reader sleeps on it when the buffer is empty.
+		std::atomic<uint32_t> waiters{0};                ///< number of readers sleeping on state
+		alignas(cache_line) std::mutex m;                ///< guards writers registration
+		size_t nwriters = 0;                             ///< number of writing slots ever given out
+		std::vector<uint32_t> free;                      ///< slots given back by gone writers
+	}; // class BufBufSync<MultiProducer>
+
+	/// Wait-free triple buffer. publish() and try_read() are a single atomic exchange of the spare slot.
+	template<>
+	class BufBufSync<SingleProducer> {
+		enum: uint32_t { fresh = 1u << 31 }; ///< flag of the spare slot holding unread published data
+	public:
+		static constexpr uint32_t none = ~0u;
+
+		explicit BufBufSync(size_t nwriters=1, size_t max_nwriters=0) {
+			if(nwriters != 1 || max_nwriters > 1){
+				throw std::runtime_error("single producer buffer has exactly one writing slot");
+			}
+		}
+
+		/// @return slot to read or none if buffer is empty
+		template<class Stats=NoStats>
+		auto try_read(Stats&& /*stats*/=Stats{})-> uint32_t {
+			if(!(spare.load() & fresh)){
+				return none;
+			}
+			rd_cur = spare.exchange(rd_cur) & ~uint32_t(fresh); // only reader clears fresh, so it is still there
+			return rd_cur;
+		}
+
+		/// Sleep till ready() returns something truthy, which is then returned.
+		template<class F>
+		auto await(F ready)-> decltype(ready()) { return detail::futex_await(spare, waiters, false, ready); }
+
+		/// @return next slot to write to
+		template<class Stats=NoStats>
+		auto publish(uint32_t id, Stats&& stats=Stats{})-> uint32_t {
+			assert(id == wr_cur); // publish the slot owned by the writer
+			(void)id;
+
+			const auto prev = spare.exchange(wr_cur | fresh);
+			wr_cur = prev & ~uint32_t(fresh);
+			if(prev & fresh){
+				stats.count_overwrite();
+			} else if(waiters.load() != 0){
+				detail::futex_wake(spare, false, 1);
+			}
+			return wr_cur;
+		}
+
+		/// @return slot of the writer or none if it is taken
+		auto take_writer()-> uint32_t { return writer_taken.exchange(true) ? none : wr_cur; }
+
+		/// Give back the writing slot, so it can be taken by another writer
+		auto release_writer(uint32_t id)-> void {
+			assert(id == wr_cur);
+			(void)id;
+			writer_taken.store(false);
+		}
+
+		const size_t nslots = 3;      ///< total number of slots
+		const size_t max_nslots = 3;  ///< single producer buffer does not grow
+	private: // data, reader side, writer side and shared state each on own cache line
+		alignas(cache_line) uint32_t rd_cur = 0; ///< slot currently being read. Reader owned.
+		alignas(cache_line) uint32_t wr_cur = 2; ///< slot currently being written. Writer owned.
+		std::atomic<bool> writer_taken{false};   ///< writing slot was given out
+		alignas(cache_line) std::atomic<uint32_t> spare{1}; ///< slot exchanged between reader and writer, with fresh flag. Reader sleeps on it.
+		std::atomic<uint32_t> waiters{0};                    ///< number of readers sleeping on spare
+	}; // class BufBufSync<SingleProducer>
+} // namespace detail
+
+/// Thread-safe multiple writers single reader circular pop-the-last buffer. Specialization for fixed size types.
+/// Every slot is a T on its own cache line(s), so writers do not share cache lines.
+/// Lock-free. Only blocking read() on empty buffer sleeps on a futex.
+/// With SingleProducer publish() and try_read() are wait-free.
+/// Stats policy may count events for stats(), the default NoStats costs nothing.
+template <class T, class Producers=MultiProducer, class Stats=NoStats>
+class BufBuf: private Stats {
+	using Sync = detail::BufBufSync<Producers>;
+	using Slot = detail::CacheAligned<T>;
+public:
+	using Writer = detail::BufBufWriter<BufBuf>;
+
+	/// Construct buffer with given number of writing slots. Actual number of slots is that + 2.
+	explicit BufBuf(size_t nslots=1       ///< number of writing slots
+	                , size_t max_nslots=0 ///< number of writing slots to grow to on demand, 0 for no growth
+	): sync(nslots, max_nslots), buf(sync.nslots, 1)
+	{
+		Stats::init(sync.max_nslots);
+	}
+
+	/// @return readable slot if buffer non-empty, nullptr otherwise.
+	/// Nonblocking. Slot data remains valid till next call to read() functions.
+	/// Does not invalidate previous data if nullptr is returned.
+	auto try_read()-> T* {
+		const auto id = sync.try_read(counters());
+		if(id == Sync::none){
+			return nullptr;
+		}
+		counters().count_read(id);
+		return &at(id);
+	}
+
+	/// @return readable slot.
+	/// Blocks till readable data becomes available.
+	/// Slot data remains valid till next call to read() functions.
+	auto read()-> T& {
+		if(auto r = try_read()){
+			return *r;
+		}
+		const auto start = Stats::now();
+		auto& r = *sync.await([this]{ return try_read(); });
+		counters().count_wait(Stats::now() - start);
+		return r;
+	}
+
+	/// @return snapshot of the counters. Available with Stats policy.
+	auto stats() const { return Stats::snapshot(); }
+
+	/// @return reference to the next slot open for writing
+	/// Publishes slot for reading.
+	auto publish(T& slot)-> T& { return at(publish_id(uint32_t(buf.id_of(reinterpret_cast<Slot*>(&slot))))); }
+
+	/// @return reference to a next writing slot. The slot is ready to be written to.
+	/// @throw std::runtime_error if no more writing slots are available.
+	auto getWriteSlot()-> T& {
+		if(auto r = getWriteSlot(std::nothrow)){
+			return *r;
+		}
+		throw std::runtime_error("writers exhausted");
+	}
+
+	/// @return pointer to a next writing slot on success, nullptr if no more writing slots are available.
+	/// Returned slot is ready to be written to.
+	auto getWriteSlot(std::nothrow_t)-> T* {
+		const auto id = take_writer();
+		return id == Sync::none ? nullptr : &at(id);
+	}
+
+	/// @return handle owning a writing slot and giving it back to the buffer on destruction.
+	/// @throw std::runtime_error if no more writing slots are available.
+	auto writer()-> Writer {
+		const auto id = take_writer();
+		if(id == Sync::none){
+			throw std::runtime_error("writers exhausted");
+		}
+		return Writer(*this, id);
+	}
+
+#if defined(__cpp_impl_coroutine)
+	/// @return awaitable of the readable slot. co_await suspends the coroutine till data is published,
+	/// then the executor resumes it. Slot data remains valid till next call to read() functions.
+	auto async_read(Executor& ex) {
+		return detail::make_read_awaiter<T&>(ex, [this]{ return try_read(); }
+		                                   , [this, &ex]{ on_publish.set(ex.event_fd()); return -1; }
+		                                   , [this]{ on_publish.set(-1); });
+	}
+#endif
+private:
+	friend Writer;
+	auto at(size_t id)-> T& { return buf.slot(id)->value; }
+	auto counters()-> Stats& { return *this; }
+	auto publish_id(uint32_t id)-> uint32_t {
+		counters().count_publish(id);
+		const auto r = sync.publish(id, counters());
+		on_publish.fire();
+		return r;
+	}
+	auto take_writer()-> uint32_t {
+		const auto id = sync.take_writer();
+		if(id != Sync::none){
+			buf.reserve(id + 1);
+		}
+		return id;
+	}
+private: // data
+	Sync sync;
+	detail::BufBufStorage<Slot> buf; ///< buffer memory
+	detail::PublishHook on_publish;
+}; // class BufBuf
 
 /// Thread-safe multiple writers single reader circular pop-the-last buffer. Specialization for array types.
-template <class T>
-class BufBuf<T[]> {
+/// Slots are padded to whole cache lines, so writers do not share cache lines.
+/// Lock-free. Only blocking read() on empty buffer sleeps on a futex.
+/// With SingleProducer publish() and try_read() are wait-free.
+/// Stats policy may count events for stats(), the default NoStats costs nothing.
+template <class T, class Producers, class Stats>
+class BufBuf<T[], Producers, Stats>: private Stats {
+	using Sync = detail::BufBufSync<Producers>;
 public:
+	using Writer = detail::BufBufWriter<BufBuf>;
+
 	/// Construct buffer with given number of writing slots. Actual number of slots is that + 2.
-	BufBuf(size_t nslots      ///< number of writing slots
-	       , size_t slotsize  ///< number of elements of type T in one slot
-	): slotsize(slotsize), buf(2*slotsize)
+	BufBuf(size_t nslots          ///< number of writing slots
+	       , size_t slotsize      ///< number of elements of type T in one slot
+	       , size_t max_nslots=0  ///< number of writing slots to grow to on demand, 0 for no growth
+	): sync(nslots, max_nslots), buf(sync.nslots, detail::padded_slot_size<T>(slotsize))
 	{
-		buf.reserve((nslots + 2)*slotsize);
-		rd_next = rd_cur = buf.data();
-		wr_next = buf.data() + slotsize;
-		assert(check());
+		Stats::init(sync.max_nslots);
 	}
+
+	/// Construct buffer with one writing slot.
+	explicit BufBuf(size_t slotsize  ///< number of elements of type T in one slot
+	): BufBuf(1, slotsize)
+	{}
 	
 	/// @return readable slot if buffer non-empty, nullptr otherwise.
 	/// Nonblocking. Slot data remains valid till next call to read() functions. 
 	/// Does not invalidate previous data if nullptr is returned.
 	auto try_read()-> T* {
-		std::lock_guard<std::mutex> lock(m);
-		assert(check());
-		if(rd_cur == rd_next){
+		const auto id = sync.try_read(counters());
+		if(id == Sync::none){
 			return nullptr;
 		}
-		wr_next = rd_cur;
-		rd_cur = rd_next;
-		assert(check());
-		return rd_cur;
+		counters().count_read(id);
+		return at(id);
 	}
 	
 	/// @return readable slot.
 	/// Blocks till readable data becomes available. 
 	/// Slot data remains valid till next call to read() functions.
 	auto read()-> T* {
-		std::unique_lock<std::mutex> lock(m);
-		assert(check());
-		while(rd_cur == rd_next){
-			cvpub.wait(lock);
+		if(auto r = try_read()){
+			return r;
 		}
-		wr_next = rd_cur;
-		rd_cur = rd_next;
-		assert(check());
-		return rd_cur;
+		const auto start = Stats::now();
+		auto r = sync.await([this]{ return try_read(); });
+		counters().count_wait(Stats::now() - start);
+		return r;
 	}
+
+	/// @return snapshot of the counters. Available with Stats policy.
+	auto stats() const { return Stats::snapshot(); }
 	
 	/// @return pointer to the next slot open for writing
 	/// Publishes slot for reading.
 	auto publish(T* publish_ptr)-> T* {
-		assert(buf.data() <= publish_ptr 
-		       && publish_ptr < buf.data() + buf.size());   // publish pointer is within cuurent buffer
-		assert((publish_ptr - buf.data()) % slotsize == 0); // publish pointer points to head of some slot
-		
-		T* ret;
-		{ std::lock_guard<std::mutex> lock(m);
-			assert(publish_ptr != rd_cur); // publish event to the slot currently being read
-			assert(check());
-			if(rd_next != rd_cur){
-				ret = rd_next;
-				rd_next = publish_ptr;
-				assert(check());
-				return ret;
-			}
-			rd_next = publish_ptr;
-			ret = wr_next;
-			assert(check());
-		}
-		cvpub.notify_one();
-		
-		return ret;
+		const auto id = buf.id_of(publish_ptr);
+		assert(publish_ptr == at(id)); // publish pointer points to head of some slot
+		return at(publish_id(uint32_t(id)));
 	}
 
 	/// @return pointer to a next writing slot. The slot is ready to be written to.
 	/// @throw std::runtime_error if no more writing slots are available.
 	auto getWriteSlot()-> T* {
-		std::lock_guard<std::mutex> lock(m);
-		assert(check());
-		if(buf.size() == buf.capacity()){
-			throw std::runtime_error("writers exhausted");
+		if(auto r = getWriteSlot(std::nothrow)){
+			return r;
 		}
-		auto r = buf.data() + buf.size();
-		buf.resize(buf.size() + slotsize);
-		assert(check());
-		return r;
+		throw std::runtime_error("writers exhausted");
 	}
 
 	/// @return pointer to a next writing slot on success, nullptr if no more writing slots are available.
 	/// Returned slot is ready to be written to.
 	auto getWriteSlot(std::nothrow_t)-> T* {
-		std::lock_guard<std::mutex> lock(m);
-		assert(check());
-		if(buf.size() == buf.capacity()){
-			return nullptr;
+		const auto id = take_writer();
+		return id == Sync::none ? nullptr : at(id);
+	}
+
+	/// @return handle owning a writing slot and giving it back to the buffer on destruction.
+	/// @throw std::runtime_error if no more writing slots are available.
+	auto writer()-> Writer {
+		const auto id = take_writer();
+		if(id == Sync::none){
+			throw std::runtime_error("writers exhausted");
+		}
+		return Writer(*this, id);
+	}
+
+#if defined(__cpp_impl_coroutine)
+	/// @return awaitable of the readable slot. co_await suspends the coroutine till data is published,
+	/// then the executor resumes it. Slot data remains valid till next call to read() functions.
+	auto async_read(Executor& ex) {
+		return detail::make_read_awaiter<T*>(ex, [this]{ return try_read(); }
+		                                   , [this, &ex]{ on_publish.set(ex.event_fd()); return -1; }
+		                                   , [this]{ on_publish.set(-1); });
+	}
+#endif
+private:
+	friend Writer;
+	auto at(size_t id)-> T* { return buf.slot(id); }
+	auto counters()-> Stats& { return *this; }
+	auto publish_id(uint32_t id)-> uint32_t {
+		counters().count_publish(id);
+		const auto r = sync.publish(id, counters());
+		on_publish.fire();
+		return r;
+	}
+	auto take_writer()-> uint32_t {
+		const auto id = sync.take_writer();
+		if(id != Sync::none){
+			buf.reserve(id + 1);
+		}
+		return id;
+	}
+private: // data
+	Sync sync;
+	detail::BufBufStorage<T> buf; ///< buffer memory, slots padded to whole cache lines
+	detail::PublishHook on_publish;
+}; // class BufBuf<T[]>
+
+/// Thread-safe keyed pop-the-last buffer. Keeps the latest value of every producer, so that a fast producer
+/// does not hide updates of slow ones. Each key has a single producer and own wait-free triple buffer.
+/// Reader learns which keys were updated since its last read from a dirty bitmask, one atomic exchange per 64 keys.
+template <class T>
+class KeyedBufBuf {
+	using Sync = detail::BufBufSync<SingleProducer>;
+	using Slot = detail::CacheAligned<T>;
+	enum { key_bits = 64 };
+public:
+	/// Construct buffer for given number of keys, i.e. producers.
+	explicit KeyedBufBuf(size_t nkeys)
+	   : syncs(nkeys), buf(3*nkeys), dirty((nkeys + key_bits - 1)/key_bits)
+	{}
+
+	auto size() const-> size_t { return syncs.size(); }
+
+	/// Visit the latest values of keys updated since last read. Nonblocking.
+	/// visit(key, const T&) is called once per updated key, the value remains valid till the next read of that key.
+	/// @return number of keys visited
+	template<class F, class = std::enable_if_t<!std::is_integral<std::decay_t<F>>::value>> // keys go to try_read(key)
+	auto try_read(F&& visit)-> size_t {
+		auto n = size_t{0};
+		for(size_t w = 0; w < dirty.size(); ++w){
+			auto bits = dirty[w].load(std::memory_order_relaxed) ? dirty[w].exchange(0) : uint64_t{0};
+			for(; bits != 0; bits &= bits - 1){
+				const auto key = w*key_bits + size_t(__builtin_ctzll(bits));
+				if(auto r = try_read(key)){
+					visit(key, static_cast<const T&>(*r));
+					++n;
+				}
+			}
+		}
+		return n;
+	}
+
+	/// Visit the latest values of keys updated since last read.
+	/// Blocks till at least one key is updated.
+	/// @return number of keys visited
+	template<class F>
+	auto read(F&& visit)-> size_t {
+		return detail::futex_await(seq, waiters, false, [&]{ return try_read(visit); });
+	}
+
+	/// @return latest value of the key if it was updated since its last read, nullptr otherwise.
+	/// Nonblocking. Slot data remains valid till the next read of that key.
+	auto try_read(size_t key)-> T* {
+		const auto id = syncs[key].try_read();
+		return id == Sync::none ? nullptr : &at(key, id);
+	}
+
+	/// Publishes slot of the key for reading.
+	/// @return reference to the next slot of the key open for writing
+	auto publish(size_t key, T& slot)-> T& {
+		const auto id = uint32_t(reinterpret_cast<Slot*>(&slot) - buf.data()) - 3*key;
+		assert(id < 3); // slot belongs to the key
+		auto& next = at(key, syncs[key].publish(id));
+		dirty[key/key_bits].fetch_or(uint64_t(1) << key % key_bits);
+		seq.fetch_add(1);
+		if(waiters.load() != 0){
+			detail::futex_wake(seq, false, 1);
+		}
+		return next;
+	}
+
+	/// @return reference to the writing slot of the key. The slot is ready to be written to.
+	/// @throw std::runtime_error if the key already has a producer.
+	auto getWriteSlot(size_t key)-> T& {
+		if(auto r = getWriteSlot(key, std::nothrow)){
+			return *r;
+		}
+		throw std::runtime_error("key has a writer");
+	}
+
+	/// @return pointer to the writing slot of the key, nullptr if the key already has a producer.
+	auto getWriteSlot(size_t key, std::nothrow_t)-> T* {
+		const auto id = syncs[key].take_writer();
+		return id == Sync::none ? nullptr : &at(key, id);
+	}
+private:
+	auto at(size_t key, uint32_t id)-> T& { return buf[3*key + id].value; }
+private: // data
+	detail::AlignedArray<Sync> syncs;           ///< triple buffer handoff per key
+	detail::AlignedArray<Slot> buf;             ///< 3 slots per key
+	std::vector<std::atomic<uint64_t>> dirty;   ///< bit per key, set on publish, cleared by reader
+	alignas(detail::cache_line) std::atomic<uint32_t> seq{0}; ///< futex word, incremented on every publish
+	std::atomic<uint32_t> waiters{0};           ///< number of readers sleeping on seq
+}; // class KeyedBufBuf
+
+/// Thread-safe multiple writers single reader lossless queue. Specialization for array types.
+/// Writers fill own slots as with the pop-the-last buffer, publish() copies the frame to a bounded ring.
+/// Ring cells carry sequence numbers, so writers claim cells lock-free and reader takes all ready cells
+/// with a single CAS. What happens when the ring is full is defined by the overflow policy.
+template <class T, Overflow overflow, class Stats>
+class BufBuf<T[], Lossless<overflow>, Stats>: private Stats {
+public:
+	/// Construct buffer with given number of writing slots and queue capacity.
+	BufBuf(size_t nslots      ///< number of writing slots
+	       , size_t slotsize  ///< number of elements of type T in one slot
+	       , size_t capacity  ///< maximum number of queued frames
+	): slotsize(slotsize), stride(detail::padded_slot_size<T>(slotsize)), capacity(capacity), max_writers(nslots)
+	 , slots((nslots + 1)*stride), ring(capacity*stride), seqs(capacity)
+	{
+		if(capacity == 0){
+			throw std::runtime_error("queue capacity must be positive");
+		}
+		for(size_t i = 0; i < capacity; ++i){
+			seqs[i].store(i, std::memory_order_relaxed);
+		}
+		Stats::init(capacity);
+	}
+
+	/// Pop up to n oldest frames to out, stored back to back. Nonblocking.
+	/// All frames available are taken in one synchronization step.
+	/// @return number of frames popped
+	auto try_read_batch(T out[], size_t n)-> size_t {
+		auto t = tail.load();
+		auto k = size_t{0};
+		for(;;){
+			for(k = 0; k < n && seqs[(t + k) % capacity].load(std::memory_order_acquire) == t + k + 1; ++k){}
+			if(k == 0){
+				return 0;
+			}
+			if(tail.compare_exchange_weak(t, t + k)){
+				break;
+			}
+			counters().count_contention();
+		}
+		for(size_t i = 0; i < k; ++i){
+			const auto cell = (t + i) % capacity;
+			counters().count_read(cell);
+			std::copy_n(ring.data() + cell*stride, slotsize, out + i*slotsize);
+			seqs[cell].store(t + i + capacity, std::memory_order_release);
+		}
+		freed.fetch_add(1);
+		if(wr_waiting.load() != 0){
+			detail::futex_wake(freed, false);
+		}
+		return k;
+	}
+
+	/// Pop up to n oldest frames to out, stored back to back. Blocks till there is at least one.
+	/// @return number of frames popped, 0 only if n is 0
+	auto read_batch(T out[], size_t n)-> size_t {
+		if(n == 0){
+			return 0;
 		}
-		auto r = buf.data() + buf.size();
-		buf.resize(buf.size() + slotsize);
-		assert(check());
+		if(const auto r = try_read_batch(out, n)){
+			return r;
+		}
+		const auto start = Stats::now();
+		const auto r = detail::futex_await(published, rd_waiting, false, [&]{ return try_read_batch(out, n); });
+		counters().count_wait(Stats::now() - start);
 		return r;
 	}
+
+	/// @return snapshot of the counters. Available with Stats policy.
+	auto stats() const { return Stats::snapshot(); }
+
+	/// @return the oldest frame if queue is non-empty, nullptr otherwise.
+	/// Nonblocking. Slot data remains valid till next call to read() functions.
+	auto try_read()-> T* { return try_read_batch(rd_slot(), 1) ? rd_slot() : nullptr; }
+
+	/// @return the oldest frame. Blocks till there is one.
+	/// Slot data remains valid till next call to read() functions.
+	auto read()-> T* {
+		read_batch(rd_slot(), 1);
+		return rd_slot();
+	}
+
+	/// Queue the frame in the slot. Nonblocking.
+	/// @return false if queue is full and overflow policy is not drop_oldest
+	auto try_publish(const T* slot)-> bool {
+		auto pos = head.load(std::memory_order_relaxed);
+		for(;;){
+			const auto cell = pos % capacity;
+			const auto diff = intptr_t(seqs[cell].load(std::memory_order_acquire)) - intptr_t(pos);
+			if(diff == 0){
+				if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+					break;
+				}
+				counters().count_contention();
+			} else if(diff < 0){ // cell still holds unread frame from the previous round
+				if(overflow != Overflow::drop_oldest){
+					return false;
+				}
+				if(tail.load() > pos - capacity){ // reader has taken the cell and is copying it out
+					std::this_thread::yield();
+				} else {
+					drop_oldest();
+				}
+				pos = head.load(std::memory_order_relaxed);
+			} else { // other writer took the cell
+				pos = head.load(std::memory_order_relaxed);
+			}
+		}
+		const auto cell = pos % capacity;
+		counters().count_publish(cell);
+		std::copy_n(slot, slotsize, ring.data() + cell*stride);
+		seqs[cell].store(pos + 1, std::memory_order_release);
+		published.fetch_add(1);
+		if(rd_waiting.load() != 0){
+			detail::futex_wake(published, false, 1);
+		}
+		on_publish.fire();
+		return true;
+	}
+
+	/// Queue the frame in the slot.
+	/// With Overflow::block waits for room in the queue.
+	/// @return the same slot, ready to be written to again.
+	/// @throw std::runtime_error if queue is full with Overflow::fail
+	auto publish(T* slot)-> T* {
+		if(!try_publish(slot)){
+			if(overflow == Overflow::fail){
+				counters().count_overwrite();
+				throw std::runtime_error("queue is full");
+			}
+			detail::futex_await(freed, wr_waiting, false, [&]{ return try_publish(slot); });
+		}
+		return slot;
+	}
+
+	/// @return pointer to a next writing slot. The slot is ready to be written to.
+	/// @throw std::runtime_error if no more writing slots are available.
+	auto getWriteSlot()-> T* {
+		if(auto r = getWriteSlot(std::nothrow)){
+			return r;
+		}
+		throw std::runtime_error("writers exhausted");
+	}
+
+	/// @return pointer to a next writing slot on success, nullptr if no more writing slots are available.
+	/// Returned slot is ready to be written to.
+	auto getWriteSlot(std::nothrow_t)-> T* {
+		auto n = nwriters.load();
+		do {
+			if(n == max_writers){
+				return nullptr;
+			}
+		} while(!nwriters.compare_exchange_weak(n, n + 1));
+		return slots.data() + (n + 1)*stride;
+	}
+
+#if defined(__cpp_impl_coroutine)
+	/// @return awaitable of the oldest frame. co_await suspends the coroutine till data is published,
+	/// then the executor resumes it. Slot data remains valid till next call to read() functions.
+	auto async_read(Executor& ex) {
+		return detail::make_read_awaiter<T*>(ex, [this]{ return try_read(); }
+		                                   , [this, &ex]{ on_publish.set(ex.event_fd()); return -1; }
+		                                   , [this]{ on_publish.set(-1); });
+	}
+#endif
 private:
-	/// Class invariant. if the buf is empty wr_next should point to a 'free' slot. 
-	/// Must hold on enter and exit of critical sections.
-	auto check()-> bool {
-		return rd_next != rd_cur || wr_next != rd_cur;
+	auto rd_slot()-> T* { return slots.data(); }
+	auto counters()-> Stats& { return *this; }
+
+	/// Drop the oldest frame, if it is ready. Otherwise let the one taking or writing it finish.
+	auto drop_oldest()-> void {
+		auto t = tail.load();
+		auto& seq = seqs[t % capacity];
+		if(seq.load(std::memory_order_acquire) == t + 1 && tail.compare_exchange_strong(t, t + 1)){
+			seq.store(t + capacity, std::memory_order_release);
+			counters().count_overwrite();
+		} else {
+			std::this_thread::yield();
+		}
 	}
 private: // data
-	const size_t slotsize; ///< size of the slot (in units of sizeof(T))
-	std::vector<T> buf;    ///< buffer memory
-	std::mutex m;
-	std::condition_variable cvpub; ///< triggered on publish() event if the buffer is empty
-	T* rd_cur;  ///< slot currently being read. rd_cur == rd_next signifies empty buffer.
-	T* rd_next; ///< slot next to read, the last published slot.
-	T* wr_next; ///< for empty buffer slot free to write. otherwise points to random slot
-}; // class BufBuf<T*>
+	const size_t slotsize;    ///< size of the slot (in units of sizeof(T))
+	const size_t stride;      ///< distance between slots (in units of sizeof(T)), whole number of cache lines
+	const size_t capacity;    ///< number of cells in the ring
+	const size_t max_writers; ///< number of writing slots
+	detail::AlignedArray<T> slots; ///< reader slot followed by writing slots
+	detail::AlignedArray<T> ring;  ///< queued frames
+	detail::AlignedArray<std::atomic<size_t>> seqs; ///< per cell: position it is free for, position + 1 when ready
+	alignas(detail::cache_line) std::atomic<size_t> head{0}; ///< next position to write
+	std::atomic<uint32_t> published{0};  ///< futex word, incremented on every publish
+	std::atomic<uint32_t> wr_waiting{0}; ///< number of writers sleeping on freed
+	std::atomic<size_t> nwriters{0};     ///< number of writing slots given out
+	alignas(detail::cache_line) std::atomic<size_t> tail{0}; ///< next position to read
+	std::atomic<uint32_t> freed{0};      ///< futex word, incremented whenever the reader makes room
+	std::atomic<uint32_t> rd_waiting{0}; ///< number of readers sleeping on published
+	detail::PublishHook on_publish;
+}; // class BufBuf<T[], Lossless>
@@ -0,0 +1,173 @@
+#pragma once
+
+#if defined(__cpp_impl_coroutine)
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+/// Small event loop resuming coroutines suspended in async_read() of BufBuf and ShmufBuf once their data arrives.
+/// Sleeps in epoll on its own eventfd, which in-process buffers signal on publish,
+/// and on notification fds of interprocess buffers. Any number of threads may run it.
+class Executor {
+	struct Parked {
+		std::coroutine_handle<> handle;
+		std::function<bool()> ready; ///< true once the coroutine can be resumed
+		int fd;                      ///< fd watched for the coroutine, -1 if none
+	};
+public:
+	Executor(): epfd(epoll_create1(EPOLL_CLOEXEC)), evfd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+		if(epfd == -1 || evfd == -1){
+			close_fds();
+			throw std::runtime_error(std::strerror(errno));
+		}
+		watch(evfd);
+	}
+	Executor(const Executor&) = delete;
+	auto operator=(const Executor&)-> Executor& = delete;
+	~Executor(){ close_fds(); }
+
+	/// eventfd to write to when data for a parked coroutine may have arrived
+	auto event_fd() const-> int { return evfd; }
+
+	/// Wake up the threads sleeping in run functions
+	auto wake() const-> void {
+		const auto one = uint64_t{1};
+		[[maybe_unused]] auto r = write(evfd, &one, sizeof(one));
+	}
+
+	/// Resume ready coroutines till none is left parked. Sleeps while none is ready.
+	auto run()-> void {
+		while(parked() != 0){
+			run_once(-1);
+		}
+		wake(); // other runners may sleep waiting for the coroutine this one has finished
+	}
+
+	/// Resume coroutines that are ready. If there are none, waits up to timeout_ms for some, -1 for no limit.
+	/// @return number of coroutines resumed
+	auto run_once(int timeout_ms=0)-> size_t {
+		auto resumed = sweep();
+		if(resumed == 0 && timeout_ms != 0 && parked() != 0){
+			auto events = std::array<epoll_event, 16>{};
+			if(epoll_wait(epfd, events.data(), int(events.size()), timeout_ms) > 0){
+				auto drain = uint64_t{};
+				[[maybe_unused]] auto r = read(evfd, &drain, sizeof(drain));
+			}
+			resumed = sweep();
+		}
+		return resumed;
+	}
+
+	/// @return number of parked coroutines
+	auto parked() const-> size_t {
+		std::lock_guard<std::mutex> lck(m);
+		return waiting.size();
+	}
+
+	/// Park the coroutine till ready() returns true. fd, if not -1, is watched for readability meanwhile.
+	auto park(std::coroutine_handle<> handle, std::function<bool()> ready, int fd=-1)-> void {
+		if(fd != -1){
+			watch(fd);
+		}
+		{ std::lock_guard<std::mutex> lck(m);
+			waiting.push_back({handle, std::move(ready), fd});
+		}
+		wake(); // data may have come before the caller got its fd or hook in place
+	}
+
+private:
+	/// Resume coroutines that are ready. @return number of resumed ones
+	auto sweep()-> size_t {
+		auto ready = std::vector<Parked>{};
+		{ std::lock_guard<std::mutex> lck(m);
+			const auto it = std::stable_partition(begin(waiting), end(waiting), [](Parked& p){ return !p.ready(); });
+			std::move(it, end(waiting), std::back_inserter(ready));
+			waiting.erase(it, end(waiting));
+		}
+		for(auto& p: ready){
+			if(p.fd != -1){
+				epoll_ctl(epfd, EPOLL_CTL_DEL, p.fd, nullptr);
+			}
+			p.handle.resume();
+		}
+		return ready.size();
+	}
+
+	auto watch(int fd)-> void {
+		auto ev = epoll_event{};
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1 && errno != EEXIST){
+			throw std::runtime_error(std::strerror(errno));
+		}
+	}
+
+	auto close_fds()-> void {
+		if(evfd != -1){ close(evfd); }
+		if(epfd != -1){ close(epfd); }
+	}
+private: // data
+	int epfd;  ///< epoll instance
+	int evfd;  ///< eventfd signalled on publish
+	mutable std::mutex m;         ///< guards waiting
+	std::vector<Parked> waiting;  ///< parked coroutines
+}; // class Executor
+
+namespace detail {
+	/// Awaitable of async_read(). Completes right away if try_read() gives data, parks the coroutine on
+	/// the executor otherwise. prepare() is called before parking to get the executor signalled on new data,
+	/// it returns fd to watch or -1, done() undoes it on resumption.
+	/// R is the result type, reference results are taken by dereferencing what try_read() returns.
+	template<class R, class TryRead, class Prepare, class Done>
+	class ReadAwaiter {
+	public:
+		ReadAwaiter(Executor& ex, TryRead try_read, Prepare prepare, Done done)
+		   : ex(ex), try_read(try_read), prepare(prepare), done(done)
+		{}
+
+		auto await_ready()-> bool {
+			result = try_read();
+			return result != nullptr;
+		}
+
+		auto await_suspend(std::coroutine_handle<> handle)-> void {
+			const auto fd = prepare();
+			ex.park(handle, [this]{ return (result = try_read()) != nullptr; }, fd);
+		}
+
+		auto await_resume()-> R {
+			done();
+			if constexpr(std::is_reference_v<R>){
+				return *result;
+			} else {
+				return result;
+			}
+		}
+	private: // data
+		Executor& ex;
+		TryRead try_read;
+		Prepare prepare;
+		Done done;
+		decltype(std::declval<TryRead&>()()) result = nullptr;
+	}; // class ReadAwaiter
+
+	template<class R, class TryRead, class Prepare, class Done>
+	auto make_read_awaiter(Executor& ex, TryRead try_read, Prepare prepare, Done done) {
+		return ReadAwaiter<R, TryRead, Prepare, Done>(ex, try_read, prepare, done);
+	}
+} // namespace detail
+
+#endif // __cpp_impl_coroutine
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+
+namespace detail {
+	static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "atomic word must be usable as a futex");
+	static_assert(ATOMIC_INT_LOCK_FREE == 2, "atomic word must be lock-free to live in shared memory");
+
+	/// Sleep while the word holds the expected value. Returns on wake-up, on value mismatch or spuriously.
+	/// @param shared set to true if the word lives in memory shared between processes
+	inline auto futex_wait(std::atomic<uint32_t>& word, uint32_t expected, bool shared
+	                       , const timespec* timeout=nullptr)-> void
+	{
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE
+		        , expected, timeout, nullptr, 0);
+	}
+
+	/// Wake up to n threads sleeping on the word.
+	inline auto futex_wake(std::atomic<uint32_t>& word, bool shared, int n=INT_MAX)-> void {
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE
+		        , n, nullptr, nullptr, 0);
+	}
+
+	/// Sleep on the word till ready() returns something truthy, which is then returned.
+	/// Whoever makes ready() true must change the word afterwards and futex_wake() it if waiters is non-zero.
+	template<class F>
+	auto futex_await(std::atomic<uint32_t>& word, std::atomic<uint32_t>& waiters, bool shared, F ready)
+	   -> decltype(ready())
+	{
+		for(;;){
+			const auto val = word.load();
+			if(auto r = ready()){
+				return r;
+			}
+			waiters.fetch_add(1);
+			if(word.load() == val){ // word did not change since the check, so waker will see waiters
+				futex_wait(word, val, shared);
+			}
+			waiters.fetch_sub(1);
+		}
+	}
+} // namespace detail
@@ -1,26 +1,107 @@
 #pragma once
 
+#include "aligned.hpp"
+#include "executor.hpp"
+#include "futex.hpp"
+
 #include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <cstring>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
 #include <tuple>
+#include <type_traits>
 
 namespace detail{
-	///
+	/// Control block of the file-lock synchronized buffer. Idx is the slot index type,
+	/// the default single byte one keeps the whole block tiny for small buffers.
+	template<class Idx=uint8_t>
 	struct ControlBlock {
+		static_assert(std::is_unsigned<Idx>::value, "slot index must be unsigned integer");
+
 		auto is_empty() const-> bool { return rd_cur == rd_next; }
 		auto set_empty(){rd_cur = rd_next;}
 
-		uint8_t wr_next;
-		uint8_t rd_cur;
-		uint8_t rd_next;
+		Idx wr_next;
+		Idx rd_cur;
+		Idx rd_next;
+	};
+
+	/// Control block of the lock-free buffer. Triple-buffer over the first three slots.
+	/// Lives in shared memory, so atomics here must be lock-free (hence address-free).
+	struct AtomicControlBlock {
+		static constexpr uint32_t fresh = 1u << 31; ///< flags the latest slot as not yet read
+
+		auto is_empty() const-> bool { return (latest.load(std::memory_order_acquire) & fresh) == 0; }
+
+		uint32_t wr_cur;               ///< slot owned by the writer
+		uint32_t rd_cur;               ///< slot owned by the reader
+		std::atomic<uint32_t> latest;  ///< last published slot, possibly or-ed with fresh flag
+		std::atomic<uint32_t> seq;     ///< futex word. incremented on every publish
+		std::atomic<uint32_t> waiters; ///< number of readers sleeping on seq
+	};
+
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "64-bit atomics must be lock-free to live in shared memory");
+
+	/// Control block of the broadcast buffer. Single writer, up to max_readers readers.
+	struct BroadcastControlBlock {
+		enum { max_readers = 32 };
+		static constexpr uint32_t none = ~0u; ///< cursor holds no slot
+
+		/// Reader cursor. Slot held by a reader is never taken by the writer.
+		struct Cursor {
+			std::atomic<uint32_t> pid;  ///< owning process, 0 if cursor is free
+			std::atomic<uint32_t> held; ///< slot currently being read or none
+			uint32_t seen;              ///< number of the last frame read by the owner
+		};
+
+		static auto pack(uint32_t seq, uint32_t slot)-> uint64_t { return uint64_t(seq) << 32 | slot; }
+		static auto seq_of(uint64_t latest)-> uint32_t { return uint32_t(latest >> 32); }
+		static auto slot_of(uint64_t latest)-> uint32_t { return uint32_t(latest); }
+
+		uint32_t wr_cur;               ///< slot owned by the writer
+		std::atomic<uint32_t> seq;     ///< futex word. incremented on every publish
+		std::atomic<uint32_t> waiters; ///< number of readers sleeping on seq
+		std::atomic<uint64_t> latest;  ///< number of the last published frame and its slot
+		Cursor readers[max_readers];
+	};
+
+	/// Control block of the seqlock buffer. Single writer cycling through slots, any number of readers.
+	struct SeqlockControlBlock {
+		static auto pack(uint32_t seq, uint32_t slot)-> uint64_t { return uint64_t(seq) << 32 | slot; }
+		static auto seq_of(uint64_t latest)-> uint32_t { return uint32_t(latest >> 32); }
+		static auto slot_of(uint64_t latest)-> uint32_t { return uint32_t(latest); }
+
+		std::atomic<uint32_t> seq;     ///< futex word. incremented on every publish
+		std::atomic<uint32_t> waiters; ///< number of readers sleeping on seq
+		std::atomic<uint64_t> latest;  ///< number of the last published frame and its slot
+	};
+
+	/// Control block of the queue buffer. Lossless SPSC ring.
+	/// head and tail count slots modulo 2*nslots, so that full and empty states differ.
+	struct QueueControlBlock {
+		alignas(cache_line) std::atomic<uint32_t> head; ///< end of published slots. Reader sleeps on it.
+		std::atomic<uint32_t> rd_waiting;               ///< number of readers sleeping on head
+		alignas(cache_line) std::atomic<uint32_t> tail; ///< end of slots released by reader. Writer sleeps on it.
+		std::atomic<uint32_t> wr_waiting;               ///< number of writers sleeping on tail
+		uint32_t rd_held;                               ///< number of slots held by reader since its last pop
 	};
 
 	// basic wrapper around flock, to give it with Lockable interface
@@ -68,282 +149,1097 @@ namespace detail{
 		File_handle(int fd): _fd(fd){}
 		File_handle(const File_handle&) = delete;
 		File_handle(File_handle&& other) noexcept : _fd(other._fd) { other._fd = -1; }
+		auto operator=(File_handle&& other) noexcept-> File_handle& {
+			std::swap(_fd, other._fd);
+			return *this;
+		}
 		~File_handle() noexcept { if(_fd != -1) close(_fd); }
 
 		auto fd() const {return _fd;}
 	private:
 		int _fd;
 	}; // struct File_handle
+
+	/// Pid of this process cached to keep getpid() syscalls off the hot path. Refreshed in forked children.
+	class SelfPid {
+	public:
+		static auto get()-> uint32_t { return instance().pid; }
+	private:
+		SelfPid(): pid(uint32_t(getpid())) {
+			pthread_atfork(nullptr, nullptr, []{ instance().pid = uint32_t(getpid()); });
+		}
+		static auto instance()-> SelfPid& {
+			static SelfPid r;
+			return r;
+		}
+		uint32_t pid;
+	}; // class SelfPid
+
+	/// @return true if process with given pid exists. 0 is nobody.
+	inline auto alive(uint32_t pid)-> bool {
+		return pid != 0 && (kill(pid_t(pid), 0) == 0 || errno == EPERM);
+	}
 } // namespace detail
 
+/// Synchronization policies for ShmufBuf
+namespace shmuf {
+	/// Synchronization by fcntl record locks on the control block and slots.
+	/// Blocking pop() waits on the lock the writer holds over the slot being written.
+	/// Idx is the slot index type of the control block, wider types allow more slots.
+	template<class Idx=uint8_t>
+	struct Locking {
+		using ControlBlock = detail::ControlBlock<Idx>;
+		enum { id = 1 | sizeof(Idx) << 8, min_slots = 3 }; // with 2 the writer would move onto the frame it just published
+		static constexpr size_t max_slots = std::min(size_t(std::numeric_limits<Idx>::max() - 1), size_t(UINT32_MAX));
+
+		// reader does not start on the first writing slot, so that first push is not taken for empty buffer
+		static auto init(ControlBlock& cb, size_t /*nslots*/)-> void { cb = ControlBlock{0, 1, 1}; }
+
+		template<class Shm>
+		static auto try_pop(const Shm& shm)-> char* {
+			auto flock = detail::Flock(shm.fd.fd(), F_WRLCK, sizeof(ControlBlock));
+			std::lock_guard<detail::Flock> lck(flock);
+
+			auto& cb = shm.control();
+			if(cb.is_empty()){
+				return nullptr;
+			}
+			cb.set_empty();
+			return shm.slot(cb.rd_cur);
+		}
 
-//template<class... Ts> struct ShmufBuf {};
+		template<class Shm>
+		static auto pop(const Shm& shm)-> char* {
+			auto& cb = shm.control();
 
-/// 'Postbox' buffer for interprocess data transfer.
-/// Memory-mapped IPC SPSC pop-the-last FIFO buffer. Overload for value types
-template<class T>
-struct ShmufBuf {
-	// TODO: static assert that T is bitwise copyable
+			auto wr_next = Idx{};
+			{
+				auto flock = detail::Flock(shm.fd.fd(), F_WRLCK, sizeof(ControlBlock));
+				std::lock_guard<detail::Flock> lck(flock);
+				if(!cb.is_empty()){
+					cb.set_empty();
+					return shm.slot(cb.rd_cur);
+				}
 
-	static auto type_size() { return sizeof(T); }
+				wr_next = cb.wr_next;
+			}
+			auto flock = detail::Flock(shm.fd.fd(), F_RDLCK, long(shm.slot_bytes), shm.slot_offset(wr_next));
+			std::lock_guard<detail::Flock> lock_blk(flock); // lazy-waiting
 
-	/// Tries to pop the value from the buffer. Nonblocking
-	/// \return Pointer to the value in the buffer. The pointer remains valid (and underlying data const) until the next call to one of pop() function. if the buffer is empty the nullptr is returned.
-	auto try_pop()-> T* {
-		auto flock = detail::Flock(fd.fd(), F_WRLCK, sizeof(detail::ControlBlock));
-		std::lock_guard<detail::Flock> lck(flock);
+			auto flock_ctl = detail::Flock(shm.fd.fd(), F_WRLCK, sizeof(ControlBlock));
+			std::lock_guard<detail::Flock> lck_ctl(flock_ctl);
 
-		auto& cb = reinterpret_cast<detail::ControlBlock&>(*ptr.get());
-		if(cb.is_empty()){
-			return nullptr;
+			cb.set_empty();
+			return shm.slot(cb.rd_cur);
 		}
-		cb.set_empty();
-		auto p = ptr.get() + sizeof(detail::ControlBlock) + cb.rd_cur*type_size();
-		return reinterpret_cast<T*>(p);
-	}
 
-	/// Returns the value from the buffer. Blocking. If the buffer is empty waits till smth is pushed there and then returns valid reference.
-	/// Returned reference remains valid (and underlying data const) untill the next call to one of pop() functions.
-	auto pop()-> T& {
-		auto& cb = reinterpret_cast<detail::ControlBlock&>(*ptr.get());
+		template<class Shm>
+		static auto write_slot(const Shm& shm)-> char* { return shm.slot(shm.control().wr_next); }
 
-		auto id_wr = uint8_t{};
-		{
-			auto flock = detail::Flock(fd.fd(), F_WRLCK, sizeof(detail::ControlBlock));
-			std::lock_guard<detail::Flock> lck(flock);
-			if(!cb.is_empty()){
-				auto p = ptr.get() + sizeof(detail::ControlBlock) + cb.rd_cur*type_size();
-				cb.set_empty();
-				return reinterpret_cast<T&>(*p);
+		template<class Shm>
+		static auto publish(const Shm& shm)-> void {
+			auto& cb = shm.control();
+			detail::Flock(shm.fd.fd(), F_WRLCK, long(shm.slot_bytes), shm.slot_offset(cb.wr_next)).unlock();
+
+			auto flock_ctl = detail::Flock(shm.fd.fd(), F_WRLCK, sizeof(ControlBlock));
+			std::lock_guard<detail::Flock> lck_ctl(flock_ctl);
+
+			cb.rd_next = cb.wr_next;
+			cb.wr_next = next_wrid(cb, shm.nslots);
+
+			detail::Flock(shm.fd.fd(), F_WRLCK, long(shm.slot_bytes), shm.slot_offset(cb.wr_next)).try_lock();
+		}
+
+		template<class Shm>
+		static auto empty(const Shm& shm)-> bool {
+			auto flock = detail::Flock(shm.fd.fd(), F_RDLCK, sizeof(ControlBlock));
+			std::lock_guard<detail::Flock> lck_ctl(flock);
+			return shm.control().is_empty();
+		}
+
+		/// Fix control block of a writer died in the middle of publish()
+		template<class Shm>
+		static auto recover(const Shm& shm)-> void {
+			auto flock_ctl = detail::Flock(shm.fd.fd(), F_WRLCK, sizeof(ControlBlock));
+			std::lock_guard<detail::Flock> lck_ctl(flock_ctl);
+			auto& cb = shm.control();
+			if(cb.wr_next == cb.rd_next || cb.wr_next == cb.rd_cur){
+				cb.wr_next = next_wrid(cb, shm.nslots);
 			}
+		}
 
-			id_wr = cb.wr_next;
+	private:
+		static auto next_wrid(const ControlBlock& cb, size_t nslots)-> Idx {
+			auto r = (cb.wr_next + 1u) % nslots;
+			while(r == cb.rd_cur){
+				r = (r + 1u) % nslots;
+			}
+			return Idx(r);
+		}
+	}; // struct Locking
+
+	/// Lock-free synchronization by atomics in shared memory. No syscalls on the hot path.
+	/// The latest slot is handed over by an atomic exchange (triple buffering), so only
+	/// three slots are ever used. Blocking pop() sleeps on a shared futex word, publish()
+	/// only makes a syscall when some reader is actually sleeping.
+	struct LockFree {
+		using ControlBlock = detail::AtomicControlBlock;
+		enum { id = 2, min_slots = 3 };
+		static constexpr size_t max_slots = UINT32_MAX >> 1;
+
+		static auto init(ControlBlock& cb, size_t /*nslots*/)-> void {
+			new(&cb) ControlBlock{};
+			cb.wr_cur = 0;
+			cb.latest.store(1);
+			cb.rd_cur = 2;
 		}
-		auto flock = detail::Flock(fd.fd(), F_RDLCK, sizeof(T), sizeof(detail::ControlBlock) + id_wr*type_size());
-		std::lock_guard<detail::Flock> lock_blk(flock); // lazy-waiting
 
-		auto flock_ctl = detail::Flock(fd.fd(), F_WRLCK, sizeof(detail::ControlBlock));
-		std::lock_guard<detail::Flock> lck_ctl(flock_ctl);
+		template<class Shm>
+		static auto try_pop(const Shm& shm)-> char* {
+			auto& cb = shm.control();
+			if(cb.is_empty()){
+				return nullptr;
+			}
+			const auto prev = cb.latest.exchange(cb.rd_cur, std::memory_order_acq_rel);
+			cb.rd_cur = prev & ~ControlBlock::fresh;
+			return shm.slot(cb.rd_cur);
+		}
 
-		cb.set_empty();
-		auto p = ptr.get() + sizeof(detail::ControlBlock) + cb.rd_cur*type_size();
-		return reinterpret_cast<T&>(*p);
-	}
+		template<class Shm>
+		static auto pop(const Shm& shm)-> char* {
+			auto& cb = shm.control();
+			return detail::futex_await(cb.seq, cb.waiters, true, [&]{ return try_pop(shm); });
+		}
 
-	///
-	auto next_wrid(const detail::ControlBlock& cb)-> uint8_t {
-		auto r = (cb.wr_next + 1) % nslots;
-		while(r == cb.rd_cur){
-			r = (r + 1) % nslots;
+		template<class Shm>
+		static auto write_slot(const Shm& shm)-> char* { return shm.slot(shm.control().wr_cur); }
+
+		template<class Shm>
+		static auto publish(const Shm& shm)-> void {
+			auto& cb = shm.control();
+			const auto prev = cb.latest.exchange(cb.wr_cur | ControlBlock::fresh, std::memory_order_acq_rel);
+			cb.wr_cur = prev & ~ControlBlock::fresh;
+			cb.seq.fetch_add(1);
+			if(cb.waiters.load() != 0){
+				detail::futex_wake(cb.seq, true);
+			}
 		}
-		return r;
-	}
 
-	///
-	auto push(const T& frame)-> void {
-		auto& cb = reinterpret_cast<detail::ControlBlock&>(*ptr.get());
+		template<class Shm>
+		static auto empty(const Shm& shm)-> bool { return shm.control().is_empty(); }
 
-		auto p = reinterpret_cast<T*>(ptr.get() + sizeof(detail::ControlBlock) + cb.wr_next*sizeof(T));
-		std::copy_n(&frame, 1, p);
+		/// Give the writer the slot that is neither latest nor read. The writer dying in publish() between
+		/// the exchange and taking the previous latest slot leaves wr_cur pointing at the latest one.
+		template<class Shm>
+		static auto recover(const Shm& shm)-> void {
+			auto& cb = shm.control();
+			const auto latest = cb.latest.load() & ~ControlBlock::fresh;
+			cb.wr_cur = 3u - cb.rd_cur - latest; // the three slots are 0, 1 and 2
+		}
+	}; // struct LockFree
+
+	/// Single writer, multiple readers lock-free synchronization.
+	/// Each reader owns a cursor in shared memory and pops the latest frame published since its
+	/// own previous pop, independently of other readers. Writer never reuses a slot held by some
+	/// reader, so a buffer with nslots serves up to nslots - 2 readers.
+	/// A handle attaches its cursor on first pop and releases it on destruction.
+	class Broadcast {
+	public:
+		using ControlBlock = detail::BroadcastControlBlock;
+		enum { id = 3, min_slots = 3 };
+		static constexpr size_t max_slots = UINT32_MAX - 1;
+
+		Broadcast() = default;
+		Broadcast(Broadcast&& other) noexcept: _cursor(other._cursor) { other._cursor = nullptr; }
+		~Broadcast() noexcept {
+			if(_cursor){
+				_cursor->held.store(ControlBlock::none);
+				_cursor->pid.store(0);
+			}
+		}
 
-		detail::Flock(fd.fd(), F_WRLCK, sizeof(T), sizeof(detail::ControlBlock) + cb.wr_next*sizeof(T)).unlock();
+		static auto init(ControlBlock& cb, size_t /*nslots*/)-> void {
+			new(&cb) ControlBlock{};
+			cb.wr_cur = 0;
+			cb.latest.store(ControlBlock::pack(0, 1));
+			for(auto& c: cb.readers){
+				c.held.store(ControlBlock::none);
+			}
+		}
 
-		auto flock_ctl = detail::Flock(fd.fd(), F_WRLCK, sizeof(detail::ControlBlock));
-		std::lock_guard<detail::Flock> lck_ctl(flock_ctl);
+		template<class Shm>
+		auto try_pop(const Shm& shm)-> char* {
+			auto& cur = cursor(shm);
+			auto& cb = shm.control();
+			auto latest = cb.latest.load();
+			if(ControlBlock::seq_of(latest) == cur.seen){
+				return nullptr;
+			}
+			for(;;){ // hold the slot, then make sure writer did not move on before it could see that
+				cur.held.store(ControlBlock::slot_of(latest));
+				const auto check = cb.latest.load();
+				if(check == latest){
+					break;
+				}
+				latest = check;
+			}
+			cur.seen = ControlBlock::seq_of(latest);
+			return shm.slot(ControlBlock::slot_of(latest));
+		}
 
-		cb.rd_next = cb.wr_next;
-		cb.wr_next = next_wrid(cb);
+		template<class Shm>
+		auto pop(const Shm& shm)-> char* {
+			auto& cb = shm.control();
+			return detail::futex_await(cb.seq, cb.waiters, true, [&]{ return try_pop(shm); });
+		}
 
-		detail::Flock(fd.fd(), F_WRLCK, sizeof(T), sizeof(detail::ControlBlock) + cb.wr_next*sizeof(T)).try_lock();
-	}
+		template<class Shm>
+		static auto write_slot(const Shm& shm)-> char* { return shm.slot(shm.control().wr_cur); }
+
+		template<class Shm>
+		static auto publish(const Shm& shm)-> void {
+			auto& cb = shm.control();
+			const auto seq = ControlBlock::seq_of(cb.latest.load()) + 1;
+			cb.latest.store(ControlBlock::pack(seq, cb.wr_cur));
+			cb.wr_cur = free_slot(cb, cb.wr_cur, shm.nslots);
+			cb.seq.fetch_add(1);
+			if(cb.waiters.load() != 0){
+				detail::futex_wake(cb.seq, true);
+			}
+		}
 
-	///
-	auto empty()-> bool {
-		auto flock = detail::Flock(fd.fd(), F_RDLCK);
-		std::lock_guard<detail::Flock> lck_ctl(flock);
+		template<class Shm>
+		auto empty(const Shm& shm) const-> bool {
+			const auto seen = _cursor ? _cursor->seen : 0u;
+			return ControlBlock::seq_of(shm.control().latest.load()) == seen;
+		}
 
-		auto& cb = reinterpret_cast<detail::ControlBlock&>(*ptr.get());
-		return cb.is_empty();
-	}
+		/// Move the writer off the latest slot if it died in the middle of publish()
+		template<class Shm>
+		static auto recover(const Shm& shm)-> void {
+			auto& cb = shm.control();
+			const auto latest = ControlBlock::slot_of(cb.latest.load());
+			if(cb.wr_cur == latest){
+				cb.wr_cur = free_slot(cb, latest, shm.nslots);
+			}
+		}
 
-	///
-	static auto create(const char* path, uint8_t nslots=3)-> ShmufBuf {
-		shm_unlink(path);
-		auto flags = int{O_RDWR | O_CREAT};
-		auto fd = shm_open(path, flags, S_IRWXU);
-		if(fd == -1){
-			throw std::runtime_error(std::strerror(errno));
+	private:
+		template<class Shm>
+		auto cursor(const Shm& shm)-> ControlBlock::Cursor& {
+			if(_cursor == nullptr){
+				_cursor = &attach(shm.control(), shm.nslots);
+			}
+			return *_cursor;
 		}
 
-		const auto len = sizeof(detail::ControlBlock) + nslots*sizeof(T);
-		if(ftruncate(fd, len) == -1){
-			close(fd);
-			throw std::runtime_error(std::strerror(errno));
+		static auto attach(ControlBlock& cb, size_t nslots)-> ControlBlock::Cursor& {
+			const auto nreaders = std::min(size_t(ControlBlock::max_readers), nslots - 2);
+			for(size_t i = 0; i < nreaders; ++i){
+				auto& c = cb.readers[i];
+				auto owner = c.pid.load();
+				if(detail::alive(owner)){
+					continue;
+				}
+				if(c.pid.compare_exchange_strong(owner, uint32_t(getpid()))){ // free or left by a dead reader
+					c.held.store(ControlBlock::none);
+					c.seen = 0;
+					return c;
+				}
+			}
+			throw std::runtime_error("readers exhausted");
 		}
 
-		auto ptr = reinterpret_cast<char*>(mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
-		return {fd, {ptr, detail::Unmapper{fd}}, nslots};
-	}
+		/// @return slot next to the latest one that is not held by any reader
+		static auto free_slot(const ControlBlock& cb, uint32_t latest, size_t nslots)-> uint32_t {
+			auto is_held = [&](uint32_t s){
+				return std::any_of(std::begin(cb.readers), std::end(cb.readers)
+				                   , [s](const ControlBlock::Cursor& c){ return c.held.load() == s; });
+			};
+			auto r = uint32_t((latest + 1) % nslots);
+			while(r == latest || is_held(r)){
+				r = uint32_t((r + 1) % nslots);
+			}
+			return r;
+		}
 
-	///
-	static auto connect(const char* path)-> ShmufBuf {
-		auto flags = int{O_RDWR};
-		auto fd = shm_open(path, flags, 0);
-		if(fd == -1){
-			throw std::runtime_error(std::strerror(errno));
+	private: // data
+		ControlBlock::Cursor* _cursor = nullptr; ///< cursor of this handle if attached as a reader
+	}; // class Broadcast
+
+	/// Lossless SPSC queue. Keeps every frame, writer blocks while the queue is full.
+	/// pop() returns the oldest unread frame, the slot is released on the next pop.
+	/// Batches of frames are moved with push_n()/pop_n() under one head/tail update.
+	struct Queue {
+		using ControlBlock = detail::QueueControlBlock;
+		enum { id = 4, min_slots = 2 };
+		static constexpr size_t max_slots = UINT32_MAX >> 1; ///< head and tail count up to 2*nslots
+
+		static auto init(ControlBlock& cb, size_t /*nslots*/)-> void { new(&cb) ControlBlock{}; }
+
+		template<class Shm>
+		static auto try_pop(const Shm& shm)-> char* {
+			release(shm);
+			return hold(shm);
 		}
 
-		struct stat stat_buf;
-		int err = fstat(fd, &stat_buf);
-		if(err == -1){
-			close(fd);
-			throw  std::runtime_error(std::strerror(errno));
+		template<class Shm>
+		static auto pop(const Shm& shm)-> char* {
+			auto& cb = shm.control();
+			release(shm);
+			return detail::futex_await(cb.head, cb.rd_waiting, true, [&]{ return hold(shm); });
 		}
 
-		const auto len = size_t(stat_buf.st_size);
-		auto ptr = reinterpret_cast<char*>(mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
-		const auto nslots = (len - sizeof(detail::ControlBlock))/sizeof(T);
-		return {fd, {ptr, detail::Unmapper{fd}}, nslots};
-	}
+		/// Blocks while the queue is full
+		template<class Shm>
+		static auto write_slot(const Shm& shm)-> char* {
+			auto& cb = shm.control();
+			const auto head = cb.head.load(std::memory_order_relaxed);
+			wait_room(shm);
+			return shm.slot(head % shm.nslots);
+		}
 
-	// data
-	detail::File_handle fd;  ///< file descriptor for a memory-mapped obj
-	detail::unique_mpt ptr;  ///< pointer to head of a shared memory buffer
-	const uint8_t nslots;    ///< number of slots in buffer
-}; // struct ShmufBuf
+		template<class Shm>
+		static auto publish(const Shm& shm)-> void { advance_head(shm, 1); }
 
+		template<class Shm>
+		static auto empty(const Shm& shm)-> bool {
+			const auto& cb = shm.control();
+			return count(shm, cb.head.load(), cb.tail.load()) == cb.rd_held;
+		}
 
-/// memory-mapped IPC SPSC pop-the-last FIFO buffer. Overload for non-static array types
-template<class T>
-struct ShmufBuf<T[]> {
-	// TODO: get rid of duplicated code
-	/// type size in bytes
-	auto type_size() const {return slot_size*sizeof(T);}
+		/// Copy n frames from src to the queue. Blocks while the queue is full.
+		template<class Shm>
+		static auto push_n(const Shm& shm, const char* src, size_t n)-> void {
+			auto& cb = shm.control();
+			while(n != 0){
+				const auto head = cb.head.load(std::memory_order_relaxed);
+				const auto k = std::min(wait_room(shm), n);
+				for(size_t i = 0; i < k; ++i, src += shm.slot_bytes){
+					const auto id = (head + i) % shm.nslots;
+					auto& seq = shm.slot_seq(id);
+					const auto s = seq.load(std::memory_order_relaxed) | 1u; // odd while being written
+					seq.store(s, std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_release);
+					std::memcpy(shm.slot(id), src, shm.slot_bytes);
+					seq.store(s + 1, std::memory_order_release);
+				}
+				advance_head(shm, k);
+				n -= k;
+			}
+		}
 
-	/// Tries to pop the value from the buffer. Nonblocking
-	/// \return Pointer to the value in the buffer. The pointer remains valid (and underlying data const) until the next call to one of pop() function. if the buffer is empty the nullptr is returned.
-	auto try_pop()-> T* {
-		auto flock = detail::Flock(fd.fd(), F_WRLCK, sizeof(detail::ControlBlock));
-		std::lock_guard<detail::Flock> lck(flock);
+		/// Copy up to n oldest frames from the queue to dst. Blocks while the queue is empty.
+		/// Torn frames are skipped, same as with pop().
+		/// @return number of frames copied
+		template<class Shm>
+		static auto pop_n(const Shm& shm, char* dst, size_t n)-> size_t {
+			auto& cb = shm.control();
+			auto copied = size_t{0};
+			while(copied == 0 && n != 0){
+				release(shm);
+				const auto tail = cb.tail.load(std::memory_order_relaxed);
+				const auto avail = detail::futex_await(cb.head, cb.rd_waiting, true
+				                                       , [&]{ return count(shm, cb.head.load(), tail); });
+				const auto k = std::min(size_t(avail), n);
+				for(size_t i = 0; i < k; ++i){
+					const auto slot = shm.slot((tail + i) % shm.nslots);
+					if(!shm.torn(slot)){
+						std::memcpy(dst + copied*shm.slot_bytes, slot, shm.slot_bytes);
+						++copied;
+					}
+				}
+				cb.rd_held = uint32_t(k);
+			}
+			release(shm);
+			return copied;
+		}
 
-		auto& cb = reinterpret_cast<detail::ControlBlock&>(*ptr.get());
-		if(cb.is_empty()){
-			return nullptr;
+		/// Fix control block of a writer died in the middle of publish().
+		/// Nothing to fix, head only moves after the slots are written.
+		template<class Shm>
+		static auto recover(const Shm&)-> void {}
+
+	private:
+		/// @return number of slots between tail and head
+		template<class Shm>
+		static auto count(const Shm& shm, uint32_t head, uint32_t tail)-> uint32_t {
+			return (head + 2*shm.nslots - tail) % (2*shm.nslots);
 		}
-		cb.set_empty();
-		return reinterpret_cast<T*>(ptr.get() + sizeof(detail::ControlBlock) + cb.rd_cur*type_size());
-	}
 
-	/// Returns the value from the buffer. Blocking. If the buffer is empty waits till smth is pushed there and then returns valid reference.
-	/// Returned reference remains valid (and underlying data const) untill the next call to one of pop() functions.
-	auto pop()-> T* {
-		auto& cb = reinterpret_cast<detail::ControlBlock&>(*ptr.get());
+		/// Hold the oldest published slot if any
+		template<class Shm>
+		static auto hold(const Shm& shm)-> char* {
+			auto& cb = shm.control();
+			const auto tail = cb.tail.load(std::memory_order_relaxed);
+			if(count(shm, cb.head.load(), tail) == 0){
+				return nullptr;
+			}
+			cb.rd_held = 1;
+			return shm.slot(tail % shm.nslots);
+		}
+
+		/// Give slots held by reader back to writer
+		template<class Shm>
+		static auto release(const Shm& shm)-> void {
+			auto& cb = shm.control();
+			if(cb.rd_held != 0){
+				const auto tail = cb.tail.load(std::memory_order_relaxed);
+				cb.tail.store((tail + cb.rd_held) % (2*shm.nslots));
+				cb.rd_held = 0;
+				if(cb.wr_waiting.load() != 0){
+					detail::futex_wake(cb.tail, true);
+				}
+			}
+		}
+
+		/// Wait till there are free slots. @return number of free slots
+		template<class Shm>
+		static auto wait_room(const Shm& shm)-> size_t {
+			auto& cb = shm.control();
+			const auto head = cb.head.load(std::memory_order_relaxed);
+			return detail::futex_await(cb.tail, cb.wr_waiting, true
+			                           , [&]{ return shm.nslots - count(shm, head, cb.tail.load()); });
+		}
+
+		template<class Shm>
+		static auto advance_head(const Shm& shm, size_t k)-> void {
+			auto& cb = shm.control();
+			cb.head.store((cb.head.load(std::memory_order_relaxed) + k) % (2*shm.nslots));
+			if(cb.rd_waiting.load() != 0){
+				detail::futex_wake(cb.head, true);
+			}
+		}
+	}; // struct Queue
+
+	/// Optimistic readers. Writer cycles through the slots, readers copy the latest frame out and
+	/// validate the copy by the slot sequence number, retrying if the writer came round meanwhile.
+	/// Readers never lock and only make a syscall to sleep in load() on empty buffer.
+	/// Frames are only accessible by copy, use try_load() and load() instead of pop().
+	class Seqlock {
+	public:
+		using ControlBlock = detail::SeqlockControlBlock;
+		enum { id = 5, min_slots = 2 };
+		static constexpr size_t max_slots = UINT32_MAX;
+
+		// writer starts on slot 0
+		static auto init(ControlBlock& cb, size_t nslots)-> void {
+			cb.seq.store(0);
+			cb.waiters.store(0);
+			cb.latest.store(ControlBlock::pack(0, uint32_t(nslots - 1)));
+		}
 
-		auto wr_next = uint8_t{};
+		/// Copy the latest frame to dst if it was not read by this handle yet
+		template<class Shm>
+		auto try_load(const Shm& shm, char* dst)-> bool {
+			auto& cb = shm.control();
+			for(;;){
+				const auto latest = cb.latest.load(std::memory_order_acquire);
+				if(ControlBlock::seq_of(latest) == seen){
+					return false;
+				}
+				if(copy(shm, ControlBlock::slot_of(latest), dst)){
+					seen = ControlBlock::seq_of(latest);
+					return true;
+				}
+			}
+		}
+
+		template<class Shm>
+		auto load(const Shm& shm, char* dst)-> void {
+			auto& cb = shm.control();
+			detail::futex_await(cb.seq, cb.waiters, true, [&]{ return try_load(shm, dst); });
+		}
+
+		template<class Shm>
+		static auto write_slot(const Shm& shm)-> char* {
+			const auto latest = shm.control().latest.load(std::memory_order_relaxed);
+			return shm.slot((ControlBlock::slot_of(latest) + 1) % shm.nslots);
+		}
+
+		template<class Shm>
+		static auto publish(const Shm& shm)-> void {
+			auto& cb = shm.control();
+			const auto latest = cb.latest.load(std::memory_order_relaxed);
+			cb.latest.store(ControlBlock::pack(ControlBlock::seq_of(latest) + 1
+			                                   , uint32_t((ControlBlock::slot_of(latest) + 1) % shm.nslots))
+			                , std::memory_order_release);
+			cb.seq.fetch_add(1);
+			if(cb.waiters.load() != 0){
+				detail::futex_wake(cb.seq, true);
+			}
+		}
+
+		template<class Shm>
+		auto empty(const Shm& shm) const-> bool {
+			return ControlBlock::seq_of(shm.control().latest.load()) == seen;
+		}
+
+		/// Nothing to fix, writer never touches the latest slot
+		template<class Shm>
+		static auto recover(const Shm&)-> void {}
+
+	private:
+		/// Copy slot to dst. @return false if the slot was written to meanwhile and the copy is torn.
+		template<class Shm>
+		static auto copy(const Shm& shm, uint32_t id, char* dst)-> bool {
+			auto& seq = shm.slot_seq(id);
+			const auto before = seq.load(std::memory_order_acquire);
+			if(before & 1u){
+				return false;
+			}
+			std::memcpy(dst, shm.slot(id), shm.slot_bytes);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return seq.load(std::memory_order_relaxed) == before;
+		}
+
+		uint32_t seen = 0; ///< number of the last frame read by this handle
+	}; // class Seqlock
+} // namespace shmuf
+
+namespace shmuf {
+	/// Memory backing the buffer. Chosen on create(), connect() follows the creator.
+	enum class Pages: uint32_t {
+		normal,           ///< regular shared memory pages
+		huge,             ///< file on a hugetlbfs mount. Needs reserved huge pages (vm.nr_hugepages).
+		transparent_huge  ///< regular shared memory advised to use transparent huge pages
+	};
+
+	/// Options of the buffer memory
+	struct Options {
+		Pages pages = Pages::normal;
+		size_t slot_align = 64;                   ///< slot alignment, power of 2. At least a cache line, e.g. page size.
+		bool populate = false;                    ///< prefault all pages on create
+		int numa_node = -1;                       ///< bind pages to this NUMA node on create, -1 for default policy
+		bool reattach = false;                    ///< on create reuse compatible segment whose writer is gone
+		const char* hugetlbfs = "/dev/hugepages"; ///< hugetlbfs mount point for Pages::huge
+	};
+} // namespace shmuf
+
+namespace detail {
+	/// Head of every buffer segment. Lets connect() validate and recover the layout chosen by create().
+	/// Control block starts on the next cache line, followed by slot sequence numbers.
+	/// Slots are aligned to slot_align.
+	struct alignas(cache_line) Header {
+		enum: uint32_t { magic_value = 0x46554d53 /* "SMUF" */, layout_version = 2 };
+
+		static auto round_up(size_t x, size_t align)-> size_t { return (x + align - 1)/align*align; }
+
+		/// @return slot alignment for given options
+		static auto slot_align(const shmuf::Options& opts)-> size_t {
+			const auto align = std::max(opts.slot_align, size_t(cache_line));
+			if(align & (align - 1)){
+				throw std::runtime_error("slot alignment must be power of 2");
+			}
+			return align;
+		}
+
+		/// Header of the segment layout for given geometry
+		Header(uint32_t sync, size_t ctl_bytes, size_t slot_bytes, size_t nslots, const shmuf::Options& opts)
+		   : magic(magic_value), version(layout_version), sync(sync), nslots(uint32_t(nslots))
+		   , slot_bytes(slot_bytes), slot_stride(round_up(slot_bytes, slot_align(opts)))
+		   , seq_offset(sizeof(Header) + round_up(ctl_bytes, cache_line))
+		   , data_offset(round_up(seq_offset + nslots*sizeof(uint32_t), slot_align(opts)))
+		   , pages(opts.pages), armed(0), writer(0)
+		{}
+
+		/// @return true if buffer with this header can be used in place of the other one
+		auto same_layout(const Header& other) const-> bool {
+			return magic == other.magic && version == other.version && sync == other.sync
+			       && nslots == other.nslots && slot_bytes == other.slot_bytes
+			       && slot_stride == other.slot_stride && data_offset == other.data_offset;
+		}
+
+		/// @return total segment size in bytes
+		auto size() const-> size_t { return data_offset + nslots*slot_stride; }
+
+		uint32_t magic;
+		uint32_t version;      ///< layout version
+		uint32_t sync;         ///< id of the synchronization policy
+		uint32_t nslots;       ///< number of slots
+		uint64_t slot_bytes;   ///< slot size in bytes
+		uint64_t slot_stride;  ///< distance between slots in bytes
+		uint64_t seq_offset;   ///< offset of slot sequence numbers
+		uint64_t data_offset;  ///< offset of the first slot
+		shmuf::Pages pages;    ///< backing memory
+		std::atomic<uint32_t> armed;  ///< reader asks writer to signal the notification fifo on next publish
+		std::atomic<uint32_t> writer; ///< pid of the writing process, 0 if none has written yet
+	};
+	static_assert(sizeof(Header) == cache_line, "header fits one cache line");
+
+	/// Untyped part of ShmufBuf. Owns the mapping and forwards slot handoff to the Sync policy.
+	/// Segment layout: [Header][Sync::ControlBlock][slot sequences][slot 0]...[slot nslots-1],
+	/// each part cache line aligned.
+	/// Every slot has a sequence number, odd while the slot is being written, so that frames torn by
+	/// a writer crash are detected and skipped by readers. Only one live process may write.
+	template<class Sync>
+	struct ShmufBase {
+		using ControlBlock = typename Sync::ControlBlock;
+
+		ShmufBase(int fd, char* ptr, const Header& head, const char* path)
+		   : fd(fd), ptr(ptr, Unmapper{fd}), slot_bytes(head.slot_bytes), nslots(head.nslots)
+		   , slot_stride(head.slot_stride), data_offset(head.data_offset), seq_offset(head.seq_offset)
+		   , path(path)
+		{}
+		ShmufBase(ShmufBase&&) = default;
+
+		/// Let other processes write once this handle is gone
+		~ShmufBase(){
+			const auto self = SelfPid::get();
+			auto cur = self;
+			if(ptr && writer_pid == self){ // moved-from handles have no mapping
+				header().writer.compare_exchange_strong(cur, 0u);
+			}
+		}
+
+		auto header() const-> Header& { return reinterpret_cast<Header&>(*ptr.get()); }
+		auto control() const-> ControlBlock& {
+			return reinterpret_cast<ControlBlock&>(*(ptr.get() + sizeof(Header)));
+		}
+		auto slot_offset(size_t id) const-> long { return long(data_offset + id*slot_stride); }
+		auto slot(size_t id) const-> char* { return ptr.get() + slot_offset(id); }
+		auto slot_id(const void* slot) const-> size_t {
+			return size_t(reinterpret_cast<const char*>(slot) - ptr.get() - data_offset)/slot_stride;
+		}
+		auto slot_seq(size_t id) const-> std::atomic<uint32_t>& {
+			return reinterpret_cast<std::atomic<uint32_t>*>(ptr.get() + seq_offset)[id];
+		}
+
+		/// @return true if the slot was not completely written, i.e. writer died or is writing it right now.
+		auto torn(const void* slot) const-> bool {
+			return slot_seq(slot_id(slot)).load(std::memory_order_acquire) & 1u;
+		}
+
+		/// @return true if the process writing to the buffer is alive. False also if nobody has written yet.
+		auto writer_alive() const-> bool { return alive(header().writer.load()); }
+
+		auto try_pop_slot()-> char* {
+			auto r = sync.try_pop(*this);
+			return r && torn(r) ? nullptr : r;
+		}
+		auto pop_slot()-> char* {
+			for(;;){
+				auto r = sync.pop(*this);
+				if(!torn(r)){
+					return r;
+				}
+			}
+		}
+		auto write_slot()-> char* {
+			if(writer_pid != SelfPid::get()){ // forked children write under their own pid
+				claim_writer();
+			}
+			auto r = sync.write_slot(*this);
+			wr_id = slot_id(r);
+			auto& seq = slot_seq(wr_id);
+			const auto s = seq.load(std::memory_order_relaxed);
+			if((s & 1u) == 0){ // mark the slot as being written
+				seq.store(s + 1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+			}
+			return r;
+		}
+		auto publish_slot()-> void {
+			auto& seq = slot_seq(wr_id);
+			seq.store((seq.load(std::memory_order_relaxed) + 1) & ~1u, std::memory_order_release);
+			sync.publish(*this);
+			notify();
+		}
+		auto push_slots(const char* src, size_t n)-> void {
+			if(writer_pid != SelfPid::get()){ // forked children write under their own pid
+				claim_writer();
+			}
+			sync.push_n(*this, src, n);
+			notify();
+		}
+		auto pop_slots(char* dst, size_t n)-> size_t { return sync.pop_n(*this, dst, n); }
+		auto try_load_slot(char* dst)-> bool { return sync.try_load(*this, dst); }
+		auto load_slot(char* dst)-> void { sync.load(*this, dst); }
+
+		///
+		auto empty()-> bool { return sync.empty(*this); }
+
+		/// @return file descriptor that becomes readable on publish after arm(). Can be used with poll/epoll.
+		/// Backed by a named fifo next to the buffer. One notified reader per buffer.
+		auto notify_fd()-> int {
+			if(notify_rd.fd() == -1){
+				const auto fifo = fifo_path(path.c_str());
+				if(mkfifo(fifo.c_str(), S_IRUSR | S_IWUSR) == -1 && errno != EEXIST){
+					throw std::runtime_error(std::strerror(errno));
+				}
+				// open for writing as well, otherwise the fifo hangs up every time the writer closes it
+				notify_rd = File_handle(open(fifo.c_str(), O_RDWR | O_NONBLOCK));
+				if(notify_rd.fd() == -1){
+					throw std::runtime_error(std::strerror(errno));
+				}
+			}
+			return notify_rd.fd();
+		}
+
+		/// Ask writer to make notify_fd() readable on the next publish. Consumes pending notifications.
+		/// @return false if there is something to pop already, so waiting on notify_fd() would stall.
+		auto arm()-> bool {
+			auto drain = std::array<char, 64>{};
+			while(read(notify_fd(), drain.data(), drain.size()) > 0){}
+			header().armed.store(1);
+			std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the one in notify()
+			return empty();
+		}
+
+		/// Create new buffer. With opts.reattach reuses existing buffer of the same layout,
+		/// keeping its content, unless it has a live writer.
+		static auto create(const char* path, size_t slot_bytes, size_t nslots
+		                   , const shmuf::Options& opts)-> ShmufBase
 		{
-			auto flock = detail::Flock(fd.fd(), F_WRLCK, sizeof(detail::ControlBlock));
-			std::lock_guard<detail::Flock> lck(flock);
-			if(!cb.is_empty()){
-				cb.set_empty();
-				auto p = ptr.get() + sizeof(detail::ControlBlock) + cb.rd_cur*type_size();
-				return reinterpret_cast<T*>(p);
+			if(nslots < Sync::min_slots || nslots > Sync::max_slots){
+				throw std::runtime_error("can not create buffer with " + std::to_string(nslots) + " number of slots");
+			}
+			const Header layout(Sync::id, sizeof(ControlBlock), slot_bytes, nslots, opts);
+			if(opts.reattach){
+				auto fd = open_segment(path, opts);
+				if(fd != -1 && compatible(fd, layout)){
+					auto r = attach(fd, path, slot_bytes);
+					if(alive(r.header().writer.load()) && r.header().writer.load() != SelfPid::get()){
+						throw std::runtime_error("buffer has a live writer");
+					}
+					r.sync.recover(r);
+					return r;
+				}
+				if(fd != -1){
+					close(fd);
+				}
+			}
+
+			auto len = layout.size();
+			auto fd = int{};
+			// remove stale segments of both kinds, connect() looks in /dev/shm first
+			const auto file = std::string(opts.hugetlbfs) + path;
+			shm_unlink(path);
+			unlink(file.c_str());
+			if(opts.pages == shmuf::Pages::huge){
+				fd = open(file.c_str(), O_RDWR | O_CREAT, S_IRWXU);
+				if(fd != -1){ // hugetlbfs file size must be multiple of huge page size
+					len = Header::round_up(len, huge_page_size(fd));
+				}
+			} else {
+				fd = shm_open(path, O_RDWR | O_CREAT, S_IRWXU);
+			}
+			if(fd == -1){
+				throw std::runtime_error(std::strerror(errno));
+			}
+
+			if(ftruncate(fd, off_t(len)) == -1){
+				close(fd);
+				throw std::runtime_error(std::strerror(errno));
 			}
 
-			wr_next = cb.wr_next;
+			unlink(fifo_path(path).c_str());
+
+			auto ptr = map(fd, len, opts);
+			const auto& head = *new(ptr) Header(Sync::id, sizeof(ControlBlock), slot_bytes, nslots, opts);
+			Sync::init(reinterpret_cast<ControlBlock&>(*(ptr + sizeof(Header))), nslots);
+			return {fd, ptr, head, path};
 		}
-		auto flock = detail::Flock(fd.fd(), F_RDLCK, sizeof(T), sizeof(detail::ControlBlock) + wr_next*type_size());
-		std::lock_guard<detail::Flock> lock_blk(flock); // lazy-waiting
 
-		auto flock_ctl = detail::Flock(fd.fd(), F_WRLCK, sizeof(detail::ControlBlock));
-		std::lock_guard<detail::Flock> lck_ctl(flock_ctl);
+		/// Connect to existing buffer. Segments backed by huge pages are looked up at opts.hugetlbfs.
+		static auto connect(const char* path, size_t slot_bytes, const shmuf::Options& opts)-> ShmufBase {
+			auto fd = open_segment(path, opts);
+			if(fd == -1){
+				throw std::runtime_error(std::strerror(errno));
+			}
+			return attach(fd, path, slot_bytes);
+		}
 
-		cb.set_empty();
-		return reinterpret_cast<T*>(ptr.get() + sizeof(detail::ControlBlock) + cb.rd_cur*type_size());
-	}
+	private:
+		/// @return file descriptor of existing segment, -1 if there is none
+		static auto open_segment(const char* path, const shmuf::Options& opts)-> int {
+			auto fd = shm_open(path, O_RDWR, 0);
+			if(fd == -1 && errno == ENOENT){
+				fd = open((std::string(opts.hugetlbfs) + path).c_str(), O_RDWR);
+			}
+			return fd;
+		}
 
-	///
-	auto next_wrid(const detail::ControlBlock& cb)-> uint8_t {
-		auto r = (cb.wr_next + 1) % nslots;
-		while(r == cb.rd_cur){
-			r = (r + 1) % nslots;
+		/// @return true if segment has the given layout
+		static auto compatible(int fd, const Header& layout)-> bool {
+			auto head = std::array<char, sizeof(Header)>{};
+			return pread(fd, head.data(), head.size(), 0) == ssize_t(head.size())
+			       && reinterpret_cast<const Header&>(head).same_layout(layout);
 		}
-		return r;
-	}
 
-	///
-	auto push(const T frame[])-> void {
-		auto& cb = reinterpret_cast<detail::ControlBlock&>(*ptr.get());
+		/// Map existing segment and validate its layout. Takes ownership of fd.
+		static auto attach(int fd, const char* path, size_t slot_bytes)-> ShmufBase {
+			struct stat stat_buf;
+			int err = fstat(fd, &stat_buf);
+			if(err == -1){
+				close(fd);
+				throw  std::runtime_error(std::strerror(errno));
+			}
+
+			const auto len = size_t(stat_buf.st_size);
+			if(len < sizeof(Header)){
+				close(fd);
+				throw std::runtime_error("incompatible buffer layout");
+			}
+			auto ptr = map(fd, len, shmuf::Options{});
+			const auto& head = reinterpret_cast<const Header&>(*ptr);
+			auto fail = [&](const std::string& what){
+				munmap(ptr, len);
+				close(fd);
+				throw std::runtime_error(what);
+			};
+			if(head.magic != Header::magic_value || head.version != Header::layout_version
+			   || head.sync != Sync::id || head.size() > len)
+			{
+				fail("incompatible buffer layout");
+			}
+			if(head.slot_bytes != slot_bytes){
+				fail("slot size mismatch");
+			}
+			if(head.nslots < Sync::min_slots || head.nslots > Sync::max_slots){
+				fail("can not create buffer with " + std::to_string(head.nslots) + " number of slots");
+			}
+			if(head.pages == shmuf::Pages::transparent_huge){ // advice is per mapping
+				madvise(ptr, len, MADV_HUGEPAGE);
+			}
+			return {fd, ptr, head, path};
+		}
 
-		auto p = reinterpret_cast<T*>(ptr.get() + sizeof(detail::ControlBlock) + cb.wr_next*type_size());
-		std::copy(frame, frame+slot_size, p);
+		/// Become the writer of the buffer, unless some other live process is
+		auto claim_writer()-> void {
+			auto& writer = header().writer;
+			const auto self = SelfPid::get();
+			auto cur = writer.load();
+			while(cur != self){
+				if(alive(cur)){
+					throw std::runtime_error("buffer has a live writer");
+				}
+				writer.compare_exchange_weak(cur, self);
+			}
+			writer_pid = self;
+		}
 
-		detail::Flock(fd.fd(), F_WRLCK, sizeof(T), sizeof(detail::ControlBlock) + cb.wr_next*type_size()).unlock();
+		/// Signal armed reader
+		auto notify()-> void {
+			std::atomic_thread_fence(std::memory_order_seq_cst); // publish is visible before armed is read
+			auto& armed = header().armed;
+			if(armed.load(std::memory_order_relaxed) == 0 || armed.exchange(0) == 0){
+				return;
+			}
+			if(notify_wr.fd() == -1){ // fails if reader has not opened it, then there is nobody to notify
+				notify_wr = File_handle(open(fifo_path(path.c_str()).c_str(), O_WRONLY | O_NONBLOCK));
+			}
+			if(notify_wr.fd() != -1){
+				const char c = 1;
+				(void)!write(notify_wr.fd(), &c, 1); // full fifo is readable anyway
+			}
+		}
 
-		auto flock_ctl = detail::Flock(fd.fd(), F_WRLCK, sizeof(detail::ControlBlock));
-		std::lock_guard<detail::Flock> lck_ctl(flock_ctl);
+		static auto fifo_path(const char* path)-> std::string { return std::string("/dev/shm") + path + ".notify"; }
+
+		/// Map the whole file. Advice, NUMA binding and prefaulting from opts are applied in that order,
+		/// so that pages are allocated according to the policy.
+		static auto map(int fd, size_t len, const shmuf::Options& opts)-> char* {
+			const auto bind = opts.numa_node >= 0;
+			const auto flags = MAP_SHARED | (opts.populate && !bind ? MAP_POPULATE : 0);
+			auto ptr = reinterpret_cast<char*>(mmap(nullptr, len, PROT_READ | PROT_WRITE, flags, fd, 0));
+			if(ptr == MAP_FAILED){
+				close(fd);
+				throw std::runtime_error(std::strerror(errno));
+			}
+			if(opts.pages == shmuf::Pages::transparent_huge){
+				madvise(ptr, len, MADV_HUGEPAGE); // only an advice, no THP support is not an error
+			}
+			if(bind){
+				const auto bits = 8*sizeof(unsigned long);
+				unsigned long nodemask[1024/(8*sizeof(unsigned long))] = {};
+				auto err = EINVAL;
+				if(size_t(opts.numa_node) < 8*sizeof(nodemask)){
+					nodemask[size_t(opts.numa_node)/bits] = 1ul << (size_t(opts.numa_node)%bits);
+					err = syscall(SYS_mbind, ptr, len, MPOL_BIND, nodemask, 8*sizeof(nodemask), 0) == 0 ? 0 : errno;
+				}
+				if(err != 0){
+					munmap(ptr, len);
+					close(fd);
+					throw std::runtime_error(std::strerror(err));
+				}
+				if(opts.populate){
+					const auto page = size_t(sysconf(_SC_PAGESIZE));
+					for(auto p = ptr; p < ptr + len; p += page){
+						*p = 0; // fault in, segment is zero-filled anyway
+					}
+				}
+			}
+			return ptr;
+		}
+
+		static auto huge_page_size(int fd)-> size_t {
+			struct statfs st;
+			return fstatfs(fd, &st) == 0 ? size_t(st.f_bsize) : size_t(sysconf(_SC_PAGESIZE));
+		}
+
+	public: // data
+		File_handle fd;           ///< file descriptor for a memory-mapped obj
+		unique_mpt ptr;           ///< pointer to head of a shared memory buffer
+		const size_t slot_bytes;  ///< slot size in bytes
+		const size_t nslots;      ///< number of slots in buffer
+		const size_t slot_stride; ///< distance between slots in bytes
+		const size_t data_offset; ///< offset of the first slot in bytes
+		const size_t seq_offset;  ///< offset of the slot sequence numbers in bytes
+		Sync sync;                ///< per-handle synchronization state
+	private:
+		std::string path;               ///< name of the buffer
+		File_handle notify_rd = -1;     ///< read end of the notification fifo
+		File_handle notify_wr = -1;     ///< write end of the notification fifo
+		uint32_t writer_pid = 0;        ///< pid this handle is registered as the writer with, 0 if none
+		size_t wr_id = 0;               ///< slot last returned by write_slot()
+	}; // struct ShmufBase
+} // namespace detail
 
-		cb.rd_next = cb.wr_next;
-		cb.wr_next = next_wrid(cb);
 
-		detail::Flock(fd.fd(), F_WRLCK, sizeof(T), sizeof(detail::ControlBlock) + cb.wr_next*type_size()).try_lock();
+/// 'Postbox' buffer for interprocess data transfer.
+/// Memory-mapped IPC SPSC pop-the-last FIFO buffer. Overload for value types.
+/// Sync is one of shmuf::Locking<> (fcntl record locks), shmuf::LockFree (atomics + futex)
+/// shmuf::Broadcast (many readers, each popping the last) or shmuf::Queue (lossless, pops the oldest).
+/// Both ends must agree on the Sync policy.
+template<class T, class Sync=shmuf::Locking<>>
+struct ShmufBuf: detail::ShmufBase<Sync> {
+	// TODO: static assert that T is bitwise copyable
+	using Base = detail::ShmufBase<Sync>;
+
+	explicit ShmufBuf(Base&& base): Base(std::move(base)) {}
+
+	static auto type_size() { return sizeof(T); }
+
+	/// Tries to pop the value from the buffer. Nonblocking
+	/// \return Pointer to the value in the buffer. The pointer remains valid (and underlying data const) until the next call to one of pop() function. if the buffer is empty the nullptr is returned.
+	auto try_pop()-> T* { return reinterpret_cast<T*>(Base::try_pop_slot()); }
+
+	/// Returns the value from the buffer. Blocking. If the buffer is empty waits till smth is pushed there and then returns valid reference.
+	/// Returned reference remains valid (and underlying data const) untill the next call to one of pop() functions.
+	auto pop()-> T& { return *reinterpret_cast<T*>(Base::pop_slot()); }
+
+#if defined(__cpp_impl_coroutine)
+	/// @return awaitable of the value popped from the buffer. co_await suspends the coroutine till a value is
+	/// pushed, possibly by another process, then the executor resumes it. Uses the notification fd.
+	/// Returned value remains valid untill the next call to one of pop() functions.
+	auto async_read(Executor& ex) {
+		return detail::make_read_awaiter<T&>(ex, [this]{ return try_pop(); }
+		                                   , [this]{ Base::arm(); return Base::notify_fd(); }
+		                                   , []{});
+	}
+#endif
+
+	/// Copies the latest value to out if it was not read yet. Nonblocking. shmuf::Seqlock only.
+	/// \return false if there is no new value
+	auto try_load(T& out)-> bool { return Base::try_load_slot(reinterpret_cast<char*>(&out)); }
+
+	/// Copies the latest value to out. If it was already read waits till the next one is pushed. shmuf::Seqlock only.
+	auto load(T& out)-> void { Base::load_slot(reinterpret_cast<char*>(&out)); }
+
+	/// @return slot currently open for writing. Fill it in place and publish() when done.
+	/// The slot remains the same until the next call to publish() or push().
+	auto acquire_write_slot()-> T* { return reinterpret_cast<T*>(Base::write_slot()); }
+
+	/// Publishes the slot returned by acquire_write_slot() for reading.
+	/// @return next slot open for writing. With shmuf::Queue waits till there is one.
+	auto publish()-> T* {
+		Base::publish_slot();
+		return acquire_write_slot();
 	}
 
 	///
-	auto empty()-> bool {
-		auto flock = detail::Flock(fd.fd(), F_RDLCK);
-		std::lock_guard<detail::Flock> lck_ctl(flock);
+	auto push(const T& frame)-> void {
+		std::copy_n(&frame, 1, acquire_write_slot());
+		Base::publish_slot();
+	}
 
-		auto& cb = reinterpret_cast<detail::ControlBlock&>(*ptr.get());
-		return cb.is_empty();
+	///
+	static auto create(const char* path, size_t nslots=3, const shmuf::Options& opts={})-> ShmufBuf {
+		return ShmufBuf(Base::create(path, sizeof(T), nslots, opts));
 	}
 
 	///
-	static auto create(const char* path, size_t buf_size, uint8_t nslots=3)-> ShmufBuf {
-		shm_unlink(path);
-		auto flags = int{O_RDWR | O_CREAT};
-		auto fd = shm_open(path, flags, S_IRWXU);
-		if(fd == -1){
-			throw std::runtime_error(std::strerror(errno));
-		}
+	static auto connect(const char* path, const shmuf::Options& opts={})-> ShmufBuf {
+		return ShmufBuf(Base::connect(path, sizeof(T), opts));
+	}
+}; // struct ShmufBuf
 
-		const auto len = sizeof(detail::ControlBlock) + nslots*sizeof(T)*buf_size;
-		if(ftruncate(fd, len) == -1){
-			close(fd);
-			throw std::runtime_error(std::strerror(errno));
-		}
 
-		auto ptr = reinterpret_cast<char*>(mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
-		std::fill_n(ptr, len, 0);
-		return {fd, {ptr, detail::Unmapper{fd}}, buf_size, nslots};
+/// memory-mapped IPC SPSC pop-the-last FIFO buffer. Overload for non-static array types
+template<class T, class Sync>
+struct ShmufBuf<T[], Sync>: detail::ShmufBase<Sync> {
+	using Base = detail::ShmufBase<Sync>;
+
+	ShmufBuf(Base&& base, size_t slot_size): Base(std::move(base)), slot_size(slot_size) {}
+
+	/// type size in bytes
+	auto type_size() const {return slot_size*sizeof(T);}
+
+	/// Tries to pop the value from the buffer. Nonblocking
+	/// \return Pointer to the value in the buffer. The pointer remains valid (and underlying data const) until the next call to one of pop() function. if the buffer is empty the nullptr is returned.
+	auto try_pop()-> T* { return reinterpret_cast<T*>(Base::try_pop_slot()); }
+
+	/// Returns the value from the buffer. Blocking. If the buffer is empty waits till smth is pushed there and then returns valid reference.
+	/// Returned reference remains valid (and underlying data const) untill the next call to one of pop() functions.
+	auto pop()-> T* { return reinterpret_cast<T*>(Base::pop_slot()); }
+
+#if defined(__cpp_impl_coroutine)
+	/// @return awaitable of the value popped from the buffer. co_await suspends the coroutine till a value is
+	/// pushed, possibly by another process, then the executor resumes it. Uses the notification fd.
+	/// Returned value remains valid untill the next call to one of pop() functions.
+	auto async_read(Executor& ex) {
+		return detail::make_read_awaiter<T*>(ex, [this]{ return try_pop(); }
+		                                   , [this]{ Base::arm(); return Base::notify_fd(); }
+		                                   , []{});
+	}
+#endif
+
+	/// Copies the latest frame to out if it was not read yet. Nonblocking. shmuf::Seqlock only.
+	/// \return false if there is no new frame
+	auto try_load(T out[])-> bool { return Base::try_load_slot(reinterpret_cast<char*>(out)); }
+
+	/// Copies the latest frame to out. If it was already read waits till the next one is pushed. shmuf::Seqlock only.
+	auto load(T out[])-> void { Base::load_slot(reinterpret_cast<char*>(out)); }
+
+	/// @return slot currently open for writing. Fill it in place and publish() when done.
+	/// The slot remains the same until the next call to publish() or push().
+	auto acquire_write_slot()-> T* { return reinterpret_cast<T*>(Base::write_slot()); }
+
+	/// Publishes the slot returned by acquire_write_slot() for reading.
+	/// @return next slot open for writing. With shmuf::Queue waits till there is one.
+	auto publish()-> T* {
+		Base::publish_slot();
+		return acquire_write_slot();
 	}
 
 	///
-	static auto connect(const char* path, size_t buf_size)-> ShmufBuf {
-		auto flags = int{O_RDWR};
-		auto fd = shm_open(path, flags, 0);
-		if(fd == -1){
-			throw std::runtime_error(std::strerror(errno));
-		}
+	auto push(const T frame[])-> void {
+		std::copy(frame, frame+slot_size, acquire_write_slot());
+		Base::publish_slot();
+	}
 
-		struct stat stat_buf;
-		int err = fstat(fd, &stat_buf);
-		if(err == -1){
-			close(fd);
-			throw  std::runtime_error(std::strerror(errno));
-		}
+	/// Push n frames stored back to back in frames. shmuf::Queue only. Blocks while the queue is full.
+	auto push_n(const T frames[], size_t n)-> void {
+		Base::push_slots(reinterpret_cast<const char*>(frames), n);
+	}
 
-		const auto len = size_t(stat_buf.st_size);
-		auto ptr = reinterpret_cast<char*>(mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
-		const auto nslots = (len - sizeof(detail::ControlBlock))/(buf_size*sizeof(T));
-		if(nslots >= std::numeric_limits<uint8_t>::max()){
-			throw std::runtime_error("can not create buffer with " + std::to_string(nslots) + " number of slots");
-		}
-		return {fd, {ptr, detail::Unmapper{fd}}, buf_size, uint8_t(nslots)};
+	/// Pop up to n oldest frames to out, stored back to back. shmuf::Queue only. Blocks while the queue is empty.
+	/// @return number of frames popped
+	auto pop_n(T out[], size_t n)-> size_t { return Base::pop_slots(reinterpret_cast<char*>(out), n); }
+
+	///
+	static auto create(const char* path, size_t buf_size, size_t nslots=3
+	                   , const shmuf::Options& opts={})-> ShmufBuf
+	{
+		return {Base::create(path, buf_size*sizeof(T), nslots, opts), buf_size};
+	}
+
+	///
+	static auto connect(const char* path, size_t buf_size, const shmuf::Options& opts={})-> ShmufBuf {
+		return {Base::connect(path, buf_size*sizeof(T), opts), buf_size};
 	}
 
 // private: // data
-	detail::File_handle fd;  ///< file descriptor for a memory-mapped obj
-	detail::unique_mpt ptr;  ///< pointer to head of a shared memory buffer
 	const size_t  slot_size; ///< slot size in sizeof(T) units
-	const uint8_t nslots;    ///< number of slots in buffer
 }; // struct ShmufBuf
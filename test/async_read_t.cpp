@@ -0,0 +1,134 @@
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+#include "bufbuf.hpp"
+#include "shmufbuf.hpp"
+
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <thread>
+#include <vector>
+
+namespace {
+	static const char* SHM_PATH = "/async_read_t";
+	static const uint32_t LAST = 1000;
+
+	/// Fire and forget coroutine
+	struct Task {
+		struct promise_type {
+			auto get_return_object()-> Task { return {}; }
+			auto initial_suspend() noexcept-> std::suspend_never { return {}; }
+			auto final_suspend() noexcept-> std::suspend_never { return {}; }
+			auto return_void()-> void {}
+			auto unhandled_exception()-> void { std::terminate(); }
+		};
+	};
+
+	/// Read values till LAST is seen, count those out of order
+	template<class Buf>
+	auto consume(Buf& buf, Executor& ex, uint32_t& last, size_t& fails)-> Task {
+		while(last != LAST){
+			const uint32_t& val = co_await buf.async_read(ex);
+			fails += size_t(val <= last);
+			last = val;
+		}
+	}
+} // namespace
+
+TEST_CASE("many consumers share a thread", "[async_read]"){
+	static const size_t CONSUMERS = 200;
+	using buf_t = BufBuf<uint32_t, SingleProducer>;
+	auto ex = Executor{};
+	auto bufs = std::deque<buf_t>(CONSUMERS);
+	auto last = std::vector<uint32_t>(CONSUMERS, 0);
+	auto fails = size_t{0};
+	for(size_t i = 0; i < CONSUMERS; ++i){
+		consume(bufs[i], ex, last[i], fails);
+	}
+	CHECK(ex.parked() == CONSUMERS);
+
+	std::thread producer([&]{
+		auto slots = std::vector<uint32_t*>{};
+		for(auto& b: bufs){ slots.push_back(&b.getWriteSlot()); }
+		for(uint32_t val = 1; val <= LAST; ++val){
+			for(size_t i = 0; i < CONSUMERS; ++i){
+				*slots[i] = val;
+				slots[i] = &bufs[i].publish(*slots[i]);
+			}
+		}
+	});
+	ex.run();
+	producer.join();
+	CHECK(fails == 0);
+	CHECK(std::count(begin(last), end(last), LAST) == CONSUMERS);
+}
+
+TEST_CASE("lossless queue consumer", "[async_read]"){
+	using buf_t = BufBuf<uint32_t[], Lossless<Overflow::block>>;
+	auto ex = Executor{};
+	buf_t buf(1, 4, 8);
+	auto got = std::vector<uint32_t>{};
+	[](buf_t& buf, Executor& ex, std::vector<uint32_t>& got)-> Task {
+		while(got.size() != LAST){
+			auto frame = co_await buf.async_read(ex);
+			got.push_back(frame[3]);
+		}
+	}(buf, ex, got);
+
+	std::thread producer([&]{
+		auto w = buf.getWriteSlot();
+		for(uint32_t val = 1; val <= LAST; ++val){
+			std::fill_n(w, 4, val);
+			w = buf.publish(w);
+		}
+	});
+	std::thread runner([&]{ ex.run(); });
+	ex.run();
+	runner.join();
+	producer.join();
+	REQUIRE(got.size() == LAST);
+	CHECK(std::is_sorted(begin(got), end(got)));
+	CHECK(std::adjacent_find(begin(got), end(got)) == end(got));
+}
+
+TEST_CASE("interprocess consumer", "[async_read]"){
+	using buf_t = ShmufBuf<uint32_t, shmuf::LockFree>;
+	auto ex = Executor{};
+	auto buf = buf_t::create(SHM_PATH);
+	auto last = uint32_t{0};
+	auto fails = size_t{0};
+	consume(buf, ex, last, fails);
+
+	auto writer = fork();
+	if(writer == 0){
+		auto wr = buf_t::connect(SHM_PATH);
+		for(uint32_t val = 1; val <= LAST; ++val){
+			wr.push(val);
+			if(val % 100 == 0){
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+		_exit(0);
+	}
+	ex.run();
+	auto status = int{};
+	waitpid(writer, &status, 0);
+	CHECK(WIFEXITED(status));
+	CHECK(fails == 0);
+	CHECK(last == LAST);
+	shm_unlink(SHM_PATH);
+	unlink((std::string("/dev/shm") + SHM_PATH + ".notify").c_str());
+}
+
+int main( int argc, char* argv[] )
+{
+	// global setup...
+	int result = Catch::Session().run( argc, argv );
+	// global clean-up...
+	return ( result < 0xff ? result : 0xff );
+}
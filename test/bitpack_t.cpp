@@ -1,5 +1,7 @@
 #include <bitpack.hpp>
 
+#include <vector>
+
 #define CATCH_CONFIG_RUNNER
 #include "catch2/catch.hpp"
 
@@ -21,6 +23,69 @@ namespace {
 		using f64_88 = Bits<64, 88>;
 	};
 	
+	/// bit by bit reference reading of bits [begin, end)
+	auto naive_bits(const uint8_t* buf, unsigned begin, unsigned end)-> uint64_t {
+		auto r = uint64_t{0};
+		for(auto i = begin; i != end; ++i){
+			r = (r << 1) | ((buf[i/8] >> (7 - i%8)) & 1u);
+		}
+		return r;
+	}
+
+	/// write and read back a field, check that bits around it are not touched
+	template<class F>
+	auto check_roundtrip(uint64_t x)-> void {
+		uint8_t buf[12] = { 0b01001010, 0b00110101, 0b11101100, 0b00101101
+		                  , 0b01001010, 0b00110101, 0b11101100, 0b00101101
+		                  , 0b01001010, 0b00110101, 0b11101100, 0b00101101 };
+		const auto before = naive_bits(buf, 0, F::Begin);
+		const auto after = naive_bits(buf, F::End, 96);
+		bits<F>(buf) = x;
+		CHECK(bits<F>(buf) == x);
+		CHECK(naive_bits(buf, F::Begin, F::End) == x);
+		CHECK(naive_bits(buf, 0, F::Begin) == before);
+		CHECK(naive_bits(buf, F::End, 96) == after);
+		bits<F>(buf) = 0u;
+		bits<F>(buf) |= x;
+		CHECK(bits<F>(buf) == x);
+	}
+
+	/// extract F from n records with the given extractor and compare to bits<F>() of every record
+	template<class F, class Extract>
+	auto check_batch(size_t stride, size_t n, Extract extract)-> void {
+		auto recs = std::vector<uint8_t>(n*stride);
+		for(size_t i = 0; i < recs.size(); ++i){
+			recs[i] = uint8_t(i*151u + 7u);
+		}
+		auto out = std::vector<detail::Uint_t<F::End - F::Begin>>(n);
+		extract(recs.data(), stride, n, out.data());
+		for(size_t i = 0; i < n; ++i){
+			CHECK(out[i] == bits<F>(recs.data() + i*stride));
+		}
+	}
+
+	template<class F>
+	auto check_batch(size_t stride, size_t n)-> void {
+		check_batch<F>(stride, n, bits_batch<F>);
+		check_batch<F>(stride, n, detail::bits_batch_scalar<F>);
+#if defined(__x86_64__)
+		if constexpr(detail::fits_word<F>()){ // vector versions take a single word
+			if(detail::has_sse41()){
+				check_batch<F>(stride, n, [](const uint8_t* recs, size_t stride, size_t n, auto out){
+					const auto done = detail::bits_batch_sse41<F>(recs, stride, n, out);
+					detail::bits_batch_scalar<F>(recs + done*stride, stride, n - done, out + done);
+				});
+			}
+			if(detail::has_avx2()){
+				check_batch<F>(stride, n, [](const uint8_t* recs, size_t stride, size_t n, auto out){
+					const auto done = detail::bits_batch_avx2<F>(recs, stride, n, out);
+					detail::bits_batch_scalar<F>(recs + done*stride, stride, n - done, out + done);
+				});
+			}
+		}
+#endif
+	}
+
 	const uint8_t cbuf[12] = { 0b01001010, 0b00110101, 0b11101100, 0b00101101
 	                         , 0b01001010, 0b00110101, 0b11101100, 0b00101101
 	                         , 0b01001010, 0b00110101, 0b11101100, 0b00101101 };
@@ -172,6 +237,194 @@ TEST_CASE("assign bitfields", "[assign_bitfields]"){
 	}
 }
 
+TEST_CASE("fields over several bytes read as a word", "[word_bitfields]"){
+	SECTION("read"){
+		CHECK(bits<Bits<1, 57>>(cbuf) == naive_bits(cbuf, 1, 57));   // 8 bytes
+		CHECK(bits<Bits<7, 63>>(cbuf) == naive_bits(cbuf, 7, 63));   // 8 bytes
+		CHECK(bits<Bits<3, 67>>(cbuf) == naive_bits(cbuf, 3, 67));   // 9 bytes, byte by byte
+		CHECK(bits<Bits<16, 80>>(cbuf) == naive_bits(cbuf, 16, 80)); // 8 complete bytes
+		CHECK(bits<Bits<70, 90>>(cbuf) == naive_bits(cbuf, 70, 90)); // 3 bytes at the end of buffer
+	}
+	SECTION("write"){
+		check_roundtrip<Bits<1, 57>>(0xa5a5a5a5a5a5a5u);
+		check_roundtrip<Bits<7, 63>>(0x5a5a5a5a5a5a5au);
+		check_roundtrip<Bits<3, 67>>(0xf0e1d2c3b4a59687u);
+		check_roundtrip<Bits<16, 80>>(0x0123456789abcdefu);
+		check_roundtrip<Bits<70, 90>>(0xabcdeu);
+		check_roundtrip<Bits<85, 96>>(0x5a5u);
+	}
+}
+
+TEST_CASE("extract a field from many records", "[bits_batch]"){
+	for(auto stride: {9u, 12u, 16u}){
+		for(auto n: {0u, 1u, 2u, 3u, 7u, 33u}){
+			check_batch<Bits<3, 5>>(stride, n);   // uint8_t
+			check_batch<Bits<5, 15>>(stride, n);  // uint16_t
+			check_batch<Bits<7, 39>>(stride, n);  // uint32_t
+			check_batch<Bits<16, 72>>(stride, n); // uint64_t
+			check_batch<Bits<1, 65>>(stride, n);  // uint64_t over 9 bytes
+		}
+	}
+}
+
+TEST_CASE("layout of all fields at once", "[bit_layout]"){
+	using L = BitLayout<H::f0_8, H::f0_1, H::f6_7, H::f5_8, H::f6_9, H::f7_8, H::f5_15
+	                   , H::f1_17, H::f0_32, H::f35_40, H::f32_64, H::f64_88, Bits<60, 70>, Bits<16, 80>>;
+	static_assert(L::Bytes == 11, "header ends with the last byte of its last field");
+
+	SECTION("unpack gives the same values as bits<>"){
+		const auto v = L::unpack(cbuf);
+		CHECK(L::get<H::f0_8>(v) == bits<H::f0_8>(cbuf));
+		CHECK(L::get<H::f0_1>(v) == bits<H::f0_1>(cbuf));
+		CHECK(L::get<H::f6_7>(v) == bits<H::f6_7>(cbuf));
+		CHECK(L::get<H::f5_8>(v) == bits<H::f5_8>(cbuf));
+		CHECK(L::get<H::f6_9>(v) == bits<H::f6_9>(cbuf));
+		CHECK(L::get<H::f7_8>(v) == bits<H::f7_8>(cbuf));
+		CHECK(L::get<H::f5_15>(v) == bits<H::f5_15>(cbuf));
+		CHECK(L::get<H::f1_17>(v) == bits<H::f1_17>(cbuf));
+		CHECK(L::get<H::f0_32>(v) == bits<H::f0_32>(cbuf));
+		CHECK(L::get<H::f35_40>(v) == bits<H::f35_40>(cbuf));
+		CHECK(L::get<H::f32_64>(v) == bits<H::f32_64>(cbuf));
+		CHECK(L::get<H::f64_88>(v) == bits<H::f64_88>(cbuf));
+		CHECK(L::get<Bits<60, 70>>(v) == 0b1101010010u);            // spans two words
+		CHECK(L::get<Bits<16, 80>>(v) == 0xec2d4a35ec2d4a35u);      // 64 bits over two words
+	}
+	SECTION("pack writes what bits<> reads and keeps the bits in between"){
+		using P = BitLayout<H::f0_1, H::f6_9, H::f35_40, Bits<60, 70>, Bits<72, 88>>;
+		uint8_t buf[12] = { 255u, 255u, 255u, 255u, 255u, 255u
+		                  , 255u, 255u, 255u, 255u, 255u, 255u };
+		P::pack(buf, P::Values{0u, 0b001u, 0b01010u, 0b1000000001u, 0b0011010111101100u});
+		CHECK(bits<H::f0_1>(buf) == 0u);
+		CHECK(bits<H::f6_9>(buf) == 0b001u);
+		CHECK(bits<H::f35_40>(buf) == 0b01010u);
+		CHECK(bits<Bits<60, 70>>(buf) == 0b1000000001u);
+		CHECK(bits<Bits<72, 88>>(buf) == 0b0011010111101100u);
+		CHECK(bits<Bits<1, 6>>(buf) == 0b11111u);
+		CHECK(bits<Bits<9, 35>>(buf) == 0x3ffffffu);
+		CHECK(buf[11] == 255u); // past the header
+		CHECK(bits<Bits<70, 72>>(buf) == 0b11u);
+		CHECK(P::unpack(buf) == P::Values{0u, 0b001u, 0b01010u, 0b1000000001u, 0b0011010111101100u});
+	}
+	SECTION("unpack many headers a column at a time"){
+		using P = BitLayout<H::f0_1, H::f5_15, H::f35_40, Bits<60, 70>, H::f64_88>;
+		const auto stride = size_t{12}, n = size_t{21};
+		auto recs = std::vector<uint8_t>(n*stride);
+		for(size_t i = 0; i < recs.size(); ++i){
+			recs[i] = uint8_t(i*97u + 3u);
+		}
+		auto c0 = std::vector<uint8_t>(n);
+		auto c1 = std::vector<uint16_t>(n);
+		auto c2 = std::vector<uint8_t>(n);
+		auto c3 = std::vector<uint16_t>(n);
+		auto c4 = std::vector<uint32_t>(n);
+		P::unpack_batch(recs.data(), stride, n, P::Columns{c0.data(), c1.data(), c2.data(), c3.data(), c4.data()});
+		for(size_t i = 0; i < n; ++i){
+			CHECK(P::unpack(recs.data() + i*stride) == P::Values{c0[i], c1[i], c2[i], c3[i], c4[i]});
+		}
+	}
+}
+
+TEMPLATE_TEST_CASE_SIG("packed array", "[packed_array]", ((uint8_t nbits), nbits), 1, 7, 17, 23, 32, 57){
+	using arr_t = PackedArray<nbits>;
+	using value_t = typename arr_t::value_type;
+	const auto max = value_t(~uint64_t{0} >> (64 - nbits));
+	const auto n = size_t{45};
+	auto vals = std::vector<value_t>(n);
+	for(size_t i = 0; i < n; ++i){
+		vals[i] = value_t((i*0x9e3779b97f4a7c15u) & max);
+	}
+
+	SECTION("values are set and read one by one"){
+		auto arr = arr_t(n);
+		for(size_t i = 0; i < n; ++i){
+			arr[i] = max;
+			arr[i] = vals[i];
+			CHECK(arr[i] == vals[i]);
+			if(i > 0){
+				CHECK(arr.get(i - 1) == vals[i - 1]); // neighbours are not touched
+			}
+		}
+		CHECK(naive_bits(arr.data(), n*nbits, 8*((n*nbits + 7)/8)) == 0u);
+	}
+	SECTION("layout is the one of Bits<>"){
+		auto arr = arr_t(n);
+		for(size_t i = 0; i < n; ++i){
+			arr[i] = vals[i];
+		}
+		for(size_t i = 0; i < n; ++i){
+			CHECK(naive_bits(arr.data(), i*nbits, (i + 1)*nbits) == vals[i]);
+		}
+		CHECK(bits<Bits<3*nbits, 4*nbits>>(arr.data()) == vals[3]);
+	}
+	SECTION("bulk pack and unpack"){
+		for(auto first: {0u, 1u, 5u, 8u}){
+			for(auto count: {0u, 1u, 9u, 16u, 37u}){
+				auto arr = arr_t(n);
+				for(size_t i = 0; i < n; ++i){
+					arr[i] = max;
+				}
+				arr.pack(first, count, vals.data());
+				for(size_t i = 0; i < n; ++i){
+					CHECK(arr[i] == (i >= first && i < first + count ? vals[i - first] : max));
+				}
+				auto out = std::vector<value_t>(count);
+				arr.unpack(first, count, out.data());
+				CHECK(out == std::vector<value_t>(vals.begin(), vals.begin() + count));
+			}
+		}
+	}
+}
+
+TEST_CASE("runtime bit fields", "[bit_stream]"){
+	const auto widths = std::vector<unsigned>{3, 1, 17, 0, 64, 8, 33, 57, 5, 12, 60, 2, 7, 16, 1, 40, 9};
+	auto vals = std::vector<uint64_t>{};
+	for(size_t i = 0; i < widths.size(); ++i){
+		vals.push_back(widths[i] == 0 ? 0u : (i*0x9e3779b97f4a7c15u) >> (64 - widths[i]));
+	}
+	auto nbits = size_t{0};
+	for(auto w: widths){
+		nbits += w;
+	}
+
+	SECTION("reader gives the same bits as bits<>"){
+		auto rd = BitReader(cbuf, sizeof(cbuf));
+		CHECK(rd.read(1) == bits<H::f0_1>(cbuf));
+		rd.skip(4);
+		CHECK(rd.read(10) == bits<H::f5_15>(cbuf));
+		rd.skip(20);
+		CHECK(rd.read(5) == bits<H::f35_40>(cbuf));
+		rd.skip(24);
+		CHECK(rd.position() == 64u);
+		CHECK(rd.read(24) == bits<H::f64_88>(cbuf));
+		CHECK(rd.bits_left() == 8u);
+		CHECK(rd.read(8) == cbuf[11]);
+		CHECK(rd.bits_left() == 0u);
+	}
+	SECTION("written fields read back, bits around are kept"){
+		for(auto offset: {0u, 5u, 13u}){
+			const auto orig = std::vector<uint8_t>((offset + nbits + 7)/8 + 2, 0xa5u);
+			auto buf = orig;
+			{
+				auto wr = BitWriter(buf.data(), buf.size());
+				wr.write(naive_bits(buf.data(), 0, offset), offset);
+				for(size_t i = 0; i < widths.size(); ++i){
+					wr.write(vals[i], widths[i]);
+				}
+				CHECK(wr.position() == offset + nbits);
+			}
+			auto rd = BitReader(buf.data(), buf.size());
+			rd.skip(offset);
+			auto pos = size_t{offset};
+			for(size_t i = 0; i < widths.size(); ++i){
+				CHECK(rd.read(widths[i]) == vals[i]);
+				CHECK(naive_bits(buf.data(), pos, pos + widths[i]) == vals[i]);
+				pos += widths[i];
+			}
+			CHECK(naive_bits(buf.data(), pos, 8*buf.size()) == naive_bits(orig.data(), pos, 8*buf.size()));
+		}
+	}
+}
+
 int main( int argc, char* argv[] )
 {
 	// global setup...
@@ -4,7 +4,10 @@
 #include "bufbuf.hpp"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <deque>
 #include <numeric>
 #include <vector>
 #include <thread>
@@ -22,7 +25,7 @@ namespace {
 		buf_t& buf;
 		value_t* writeslot;
 		size_t counter;
-		bool stop; // dirty stopper
+		std::atomic<bool> stop;
 		
 		explicit Writer(buf_t& buf) : buf(buf), writeslot(buf.getWriteSlot()), stop(false) {}
 		
@@ -65,7 +68,7 @@ namespace {
 
 TEST_CASE(){
 	buf_t buf(PRODUCERS, SLOTSIZE);
-	auto writers = std::vector<Writer>{};
+	auto writers = std::deque<Writer>{}; // Writer is not movable
 	for(size_t i = 0; i < PRODUCERS; ++i){ writers.emplace_back(buf); }
 	Reader rd(buf);
 	const auto values = std::vector<value_t>{30, 50, 70}; // start of a 16-range of values written by each writer
@@ -133,6 +136,363 @@ TEST_CASE(){
 	}
 }
 
+TEST_CASE("pop the last value"){
+	buf_t buf(2, SLOTSIZE);
+	auto w1 = buf.getWriteSlot();
+	auto w2 = buf.getWriteSlot();
+	CHECK(buf.try_read() == nullptr);
+
+	std::fill_n(w1, SLOTSIZE, 1);
+	w1 = buf.publish(w1);
+	std::fill_n(w2, SLOTSIZE, 2);
+	w2 = buf.publish(w2);
+	auto r = buf.read();
+	CHECK(r[0] == 2);
+	CHECK(buf.try_read() == nullptr);
+	CHECK(r[0] == 2); // failed try_read() keeps the slot
+
+	std::fill_n(w1, SLOTSIZE, 3);
+	buf.publish(w1);
+	r = buf.try_read();
+	REQUIRE(r != nullptr);
+	CHECK(r[SLOTSIZE - 1] == 3);
+}
+
+TEST_CASE("single producer"){
+	using sp_buf_t = BufBuf<uint32_t[], SingleProducer>;
+	sp_buf_t buf(SLOTSIZE);
+	auto w = buf.getWriteSlot();
+	CHECK(buf.getWriteSlot(std::nothrow) == nullptr);
+	CHECK(buf.try_read() == nullptr);
+
+	SECTION("pop the last value"){
+		std::fill_n(w, SLOTSIZE, 1u);
+		w = buf.publish(w);
+		std::fill_n(w, SLOTSIZE, 2u);
+		w = buf.publish(w);
+		auto r = buf.read();
+		CHECK(r[0] == 2);
+		CHECK(buf.try_read() == nullptr);
+		std::fill_n(w, SLOTSIZE, 3u);
+		buf.publish(w);
+		CHECK(r[0] == 2); // slot being read is not touched by the writer
+		r = buf.try_read();
+		REQUIRE(r != nullptr);
+		CHECK(r[SLOTSIZE - 1] == 3);
+	}
+	SECTION("values come in order and whole"){
+		const auto last = uint32_t{100000};
+		std::thread writer([&]{
+			for(uint32_t i = 1; i <= last; ++i){
+				std::fill_n(w, SLOTSIZE, i);
+				w = buf.publish(w);
+			}
+		});
+		auto prev = uint32_t{0};
+		auto fails = size_t{0};
+		while(prev != last){
+			auto r = buf.read();
+			fails += size_t(std::count(r, r + SLOTSIZE, r[0]) != SLOTSIZE || r[0] <= prev);
+			prev = r[0];
+		}
+		writer.join();
+		CHECK(fails == 0);
+	}
+}
+
+TEST_CASE("writers do not share cache lines"){
+	buf_t buf(PRODUCERS, SLOTSIZE);
+	auto slots = std::vector<uintptr_t>{};
+	for(size_t i = 0; i < PRODUCERS; ++i){
+		slots.push_back(reinterpret_cast<uintptr_t>(buf.getWriteSlot()));
+	}
+	std::sort(begin(slots), end(slots));
+	for(size_t i = 0; i < PRODUCERS; ++i){
+		CHECK(slots[i] % 64 == 0);
+		if(i > 0){
+			CHECK(slots[i] - slots[i - 1] >= 64);
+		}
+	}
+	static_assert(detail::padded_slot_size<uint8_t>(16) == 64, "");
+	static_assert(detail::padded_slot_size<uint32_t>(17) == 32, "");
+	static_assert(detail::padded_slot_size<std::array<char, 12>>(1) == 16, "");
+}
+
+TEST_CASE("writers come and go"){
+	SECTION("slots of gone writers are reused"){
+		buf_t buf(1, SLOTSIZE);
+		for(value_t i = 0; i < 100; ++i){
+			auto w = buf.writer();
+			std::fill_n(w.slot(), SLOTSIZE, i);
+			w.publish();
+		}
+		auto w = buf.writer();
+		CHECK_THROWS(buf.writer());
+		CHECK(buf.read()[0] == 99);
+	}
+	SECTION("buffer grows without moving slots"){
+		buf_t buf(1, SLOTSIZE, 100);
+		auto writers = std::vector<buf_t::Writer>{};
+		writers.push_back(buf.writer());
+		const auto first = writers.front().slot();
+		for(size_t i = 1; i < 100; ++i){
+			writers.push_back(buf.writer());
+		}
+		CHECK_THROWS(buf.writer());
+		CHECK(writers.front().slot() == first);
+		for(auto& w: writers){
+			std::fill_n(w.slot(), SLOTSIZE, value_t(&w - writers.data()));
+			w.publish();
+		}
+		auto r = buf.read();
+		CHECK(std::count(r, r + SLOTSIZE, 99) == SLOTSIZE);
+	}
+	SECTION("concurrent producers"){
+		buf_t buf(1, SLOTSIZE, PRODUCERS);
+		std::atomic<bool> stop{false};
+		auto fails = size_t{0};
+		std::thread reader([&]{
+			while(!stop){
+				if(auto r = buf.try_read()){
+					fails += size_t(std::count(r, r + SLOTSIZE, r[0]) != SLOTSIZE);
+				}
+			}
+		});
+		for(int round = 0; round < 20; ++round){
+			auto threads = std::vector<std::thread>{};
+			for(size_t i = 0; i < PRODUCERS; ++i){
+				threads.emplace_back([&buf, i]{
+					auto w = buf.writer();
+					for(value_t k = 0; k < 100; ++k){
+						std::fill_n(w.slot(), SLOTSIZE, value_t(i + k));
+						w.publish();
+					}
+				});
+			}
+			for(auto& t: threads){ t.join(); }
+		}
+		stop = true;
+		reader.join();
+		CHECK(fails == 0);
+	}
+}
+
+TEMPLATE_TEST_CASE("fixed size values", "", MultiProducer, SingleProducer){
+	struct Frame { uint64_t seq; double x, y, z; };
+	BufBuf<Frame, TestType> buf;
+	auto& w = buf.getWriteSlot();
+	CHECK(buf.getWriteSlot(std::nothrow) == nullptr);
+	CHECK(reinterpret_cast<uintptr_t>(&w) % 64 == 0);
+	CHECK(buf.try_read() == nullptr);
+
+	w = Frame{1, 1., 2., 3.};
+	auto& w2 = buf.publish(w);
+	CHECK(&w2 != &w);
+	w2 = Frame{2, 4., 5., 6.};
+	auto& w3 = buf.publish(w2);
+	auto& r = buf.read();
+	CHECK(r.seq == 2);
+	CHECK(r.z == 6.);
+	CHECK(buf.try_read() == nullptr);
+
+	w3 = Frame{3, 0., 0., 0.};
+	buf.publish(w3);
+	auto r2 = buf.try_read();
+	REQUIRE(r2 != nullptr);
+	CHECK(r2->seq == 3);
+}
+
+TEST_CASE("keyed postbox"){
+	static const size_t KEYS = 70; // more than fits one word of the dirty mask
+	KeyedBufBuf<uint32_t> buf(KEYS);
+	auto collect = [](std::vector<uint32_t>& seen){
+		return [&seen](size_t key, const uint32_t& val){ seen[key] = val; };
+	};
+	auto seen = std::vector<uint32_t>(KEYS, 0);
+	CHECK(buf.try_read(collect(seen)) == 0);
+
+	SECTION("latest value of every key"){
+		auto& fast = buf.getWriteSlot(0);
+		auto& slow = buf.getWriteSlot(KEYS - 1);
+		CHECK(buf.getWriteSlot(0, std::nothrow) == nullptr);
+		auto* w = &fast;
+		for(uint32_t i = 1; i <= 10; ++i){
+			*w = i;
+			w = &buf.publish(0, *w);
+		}
+		slow = 42;
+		buf.publish(KEYS - 1, slow);
+		CHECK(buf.read(collect(seen)) == 2);
+		CHECK(seen[0] == 10);
+		CHECK(seen[KEYS - 1] == 42);
+		CHECK(buf.try_read(collect(seen)) == 0);
+	}
+	SECTION("read one key"){
+		auto& w = buf.getWriteSlot(1);
+		CHECK(buf.try_read(1) == nullptr);
+		w = 7;
+		buf.publish(1, w);
+		auto r = buf.try_read(1);
+		REQUIRE(r != nullptr);
+		CHECK(*r == 7);
+		CHECK(buf.try_read(1) == nullptr);
+	}
+	SECTION("concurrent producers"){
+		static const uint32_t LAST = 10000;
+		auto threads = std::vector<std::thread>{};
+		for(size_t key = 0; key < KEYS; key += 23){
+			threads.emplace_back([&buf, key]{
+				auto* w = &buf.getWriteSlot(key);
+				for(uint32_t i = 1; i <= LAST/uint32_t(key + 1); ++i){
+					*w = i;
+					w = &buf.publish(key, *w);
+				}
+			});
+		}
+		auto done = [&]{
+			for(size_t key = 0; key < KEYS; key += 23){
+				if(seen[key] != LAST/uint32_t(key + 1)){ return false; }
+			}
+			return true;
+		};
+		auto stale = size_t{0};
+		while(!done()){
+			buf.read([&](size_t key, const uint32_t& val){
+				stale += size_t(val <= seen[key]);
+				seen[key] = val;
+			});
+		}
+		for(auto& t: threads){ t.join(); }
+		CHECK(stale == 0);
+	}
+}
+
+TEST_CASE("lossless queue"){
+	using counter_t = uint32_t;
+	auto publish_n = [](auto& buf, counter_t* w, counter_t from, counter_t to){
+		for(auto i = from; i < to; ++i){
+			std::fill_n(w, SLOTSIZE, i);
+			w = buf.publish(w);
+		}
+	};
+	auto out = std::vector<counter_t>(8*SLOTSIZE);
+
+	SECTION("fail when full"){
+		BufBuf<counter_t[], Lossless<Overflow::fail>> buf(1, SLOTSIZE, 4);
+		auto w = buf.getWriteSlot();
+		publish_n(buf, w, 0, 4);
+		CHECK_FALSE(buf.try_publish(w));
+		CHECK_THROWS(buf.publish(w));
+		CHECK(buf.read_batch(out.data(), 0) == 0);
+		REQUIRE(buf.try_read_batch(out.data(), 8) == 4);
+		for(counter_t i = 0; i < 4; ++i){
+			CHECK(std::count(begin(out) + i*SLOTSIZE, begin(out) + (i + 1)*SLOTSIZE, i) == SLOTSIZE);
+		}
+		CHECK(buf.try_read() == nullptr);
+	}
+	SECTION("drop the oldest when full"){
+		BufBuf<counter_t[], Lossless<Overflow::drop_oldest>> buf(1, SLOTSIZE, 4);
+		publish_n(buf, buf.getWriteSlot(), 0, 6);
+		REQUIRE(buf.read_batch(out.data(), 8) == 4);
+		CHECK(out[0] == 2);
+		CHECK(out[3*SLOTSIZE] == 5);
+	}
+	SECTION("do not drop frames the reader is taking"){
+		static const size_t BIGSIZE = size_t(1) << 22; // copying out takes longer than a time slice
+		BufBuf<counter_t[], Lossless<Overflow::drop_oldest>, Stats> buf(1, BIGSIZE, 4);
+		auto w = buf.getWriteSlot();
+		auto big = std::vector<counter_t>(5*BIGSIZE);
+		for(counter_t round = 0; round < 5; ++round){
+			for(counter_t i = 0; i < 4; ++i){
+				std::fill_n(w, BIGSIZE, i);
+				w = buf.publish(w);
+			}
+			const auto reads = buf.stats().reads;
+			auto taken = size_t{0};
+			std::thread reader([&]{ taken = buf.try_read_batch(big.data(), 1); });
+			while(buf.stats().reads == reads){ // reads are counted once the cell is taken, before it is copied
+				std::this_thread::yield();
+			}
+			std::fill_n(w, BIGSIZE, 4);
+			w = buf.publish(w);
+			reader.join();
+			taken += buf.try_read_batch(big.data() + taken*BIGSIZE, 4);
+			CHECK(taken >= 4); // at most the one frame not yet taken when publishing is dropped
+			CHECK(big[(taken - 1)*BIGSIZE] == 4);
+		}
+		CHECK(buf.stats().overwritten <= 5);
+	}
+	SECTION("block when full"){
+		static const counter_t FRAMES = 20000;
+		BufBuf<counter_t[], Lossless<Overflow::block>> buf(PRODUCERS, SLOTSIZE, 16);
+		auto threads = std::vector<std::thread>{};
+		for(size_t i = 0; i < PRODUCERS; ++i){
+			threads.emplace_back([&buf, i, &publish_n]{
+				publish_n(buf, buf.getWriteSlot(), counter_t(i*FRAMES), counter_t((i + 1)*FRAMES));
+			});
+		}
+		auto next = std::vector<counter_t>{0, FRAMES, 2*FRAMES}; // next expected value of every producer
+		auto fails = size_t{0};
+		for(size_t got = 0; got < PRODUCERS*FRAMES; ){
+			const auto n = buf.read_batch(out.data(), 8);
+			for(size_t k = 0; k < n; ++k){
+				const auto val = out[k*SLOTSIZE];
+				auto& expected = next[val/FRAMES];
+				fails += size_t(val != expected || out[(k + 1)*SLOTSIZE - 1] != val);
+				expected = val + 1;
+			}
+			got += n;
+		}
+		for(auto& t: threads){ t.join(); }
+		CHECK(fails == 0);
+		CHECK(buf.try_read() == nullptr);
+	}
+}
+
+TEST_CASE("statistics"){
+	static_assert(std::is_empty<NoStats>::value, "disabled statistics take no room");
+
+	SECTION("pop the last buffer"){
+		BufBuf<uint32_t[], MultiProducer, Stats> buf(1, SLOTSIZE);
+		auto w = buf.getWriteSlot();
+		for(uint32_t i = 0; i < 5; ++i){
+			w = buf.publish(w);
+		}
+		CHECK(buf.try_read() != nullptr);
+		CHECK(buf.try_read() == nullptr);
+
+		std::thread writer([&]{
+			std::this_thread::sleep_for(10ms);
+			buf.publish(w);
+		});
+		buf.read();
+		writer.join();
+
+		const auto s = buf.stats();
+		CHECK(s.publishes == 6);
+		CHECK(s.reads == 2);
+		CHECK(s.overwritten == 4);
+		CHECK(s.empty_waits == 1);
+		CHECK(s.wait_ns >= 1000000);
+		CHECK(std::accumulate(begin(s.latency), end(s.latency), uint64_t{0}) == 2);
+	}
+	SECTION("lossless queue"){
+		BufBuf<uint32_t[], Lossless<Overflow::drop_oldest>, Stats> buf(1, SLOTSIZE, 4);
+		auto w = buf.getWriteSlot();
+		for(uint32_t i = 0; i < 6; ++i){
+			w = buf.publish(w);
+		}
+		auto out = std::vector<uint32_t>(8*SLOTSIZE);
+		CHECK(buf.read_batch(out.data(), 8) == 4);
+
+		const auto s = buf.stats();
+		CHECK(s.publishes == 6);
+		CHECK(s.reads == 4);
+		CHECK(s.overwritten == 2);
+		CHECK(s.empty_waits == 0);
+	}
+}
+
 int main( int argc, char* argv[] )
 {
 	// global setup...
@@ -0,0 +1,665 @@
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+#include "shmufbuf.hpp"
+
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <numeric>
+#include <string>
+#include <thread>
+
+namespace {
+	const auto SHM_PATH = "/shmufbuf_t";
+	static const size_t SLOTSIZE = 256;
+	static const size_t FRAMES = 10000;
+
+	using frame_t = std::array<uint32_t, 4>;
+
+	auto make_frame(uint32_t val)-> frame_t { return {val, val, val, val}; }
+
+	/// fork a process running f(). @return child exit status.
+	template<class F>
+	auto run_forked(F f)-> pid_t {
+		auto pid = fork();
+		if(pid == 0){
+			f();
+			_exit(0);
+		}
+		return pid;
+	}
+
+	auto wait_exit(pid_t pid)-> int {
+		auto status = int{};
+		waitpid(pid, &status, 0);
+		return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	}
+} // namespace
+
+TEMPLATE_TEST_CASE("pop the last value", "[shmufbuf]", shmuf::Locking<>, shmuf::LockFree){
+	CHECK_THROWS(ShmufBuf<frame_t, TestType>::create(SHM_PATH, 2)); // writer needs a slot to move to
+	auto buf = ShmufBuf<frame_t, TestType>::create(SHM_PATH);
+	CHECK(buf.empty());
+	CHECK(buf.try_pop() == nullptr);
+
+	buf.push(make_frame(1));
+	CHECK(!buf.empty());
+	auto p = buf.try_pop();
+	REQUIRE(p != nullptr);
+	CHECK(*p == make_frame(1));
+	CHECK(buf.empty());
+	CHECK(buf.try_pop() == nullptr);
+
+	for(uint32_t i = 2; i < 10; ++i){ buf.push(make_frame(i)); }
+	CHECK(buf.pop() == make_frame(9));
+	CHECK(buf.try_pop() == nullptr);
+
+	auto rd = ShmufBuf<frame_t, TestType>::connect(SHM_PATH);
+	buf.push(make_frame(10));
+	CHECK(rd.pop() == make_frame(10));
+	CHECK(buf.empty());
+	shm_unlink(SHM_PATH);
+}
+
+TEMPLATE_TEST_CASE("array slots", "[shmufbuf]", shmuf::Locking<>, shmuf::LockFree){
+	using buf_t = ShmufBuf<uint8_t[], TestType>;
+	auto buf = buf_t::create(SHM_PATH, SLOTSIZE);
+	auto rd = buf_t::connect(SHM_PATH, SLOTSIZE);
+	CHECK(rd.nslots == buf.nslots);
+
+	auto frame = std::vector<uint8_t>(SLOTSIZE, 7);
+	buf.push(frame.data());
+	auto p = rd.try_pop();
+	REQUIRE(p != nullptr);
+	CHECK(std::equal(p, p + SLOTSIZE, begin(frame)));
+	CHECK(rd.try_pop() == nullptr);
+	shm_unlink(SHM_PATH);
+
+	CHECK_THROWS(buf_t::connect(SHM_PATH, SLOTSIZE));
+}
+
+TEMPLATE_TEST_CASE("write in place", "[shmufbuf]", shmuf::Locking<>, shmuf::LockFree){
+	using buf_t = ShmufBuf<uint8_t[], TestType>;
+	auto buf = buf_t::create(SHM_PATH, SLOTSIZE);
+
+	auto wr = buf.acquire_write_slot();
+	CHECK(wr == buf.acquire_write_slot()); // same slot till publish
+	std::fill_n(wr, SLOTSIZE, 1);
+	CHECK(buf.try_pop() == nullptr);       // nothing visible before publish
+	auto next = buf.publish();
+	CHECK(next != wr);
+	CHECK(next == buf.acquire_write_slot());
+
+	auto p = buf.try_pop();
+	CHECK(p == wr);
+	CHECK(std::count(p, p + SLOTSIZE, 1) == SLOTSIZE);
+
+	std::fill_n(next, SLOTSIZE, 2);
+	next = buf.publish();
+	CHECK(next != p);                      // slot being read is not handed to the writer
+	CHECK(buf.pop()[SLOTSIZE - 1] == 2);
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("backing memory options", "[shmufbuf]"){
+	using buf_t = ShmufBuf<uint8_t[], shmuf::LockFree>;
+	auto opts = shmuf::Options{};
+	auto frame = std::vector<uint8_t>(SLOTSIZE, 3);
+
+	SECTION("transparent huge pages, prefaulted on numa node 0"){
+		opts.pages = shmuf::Pages::transparent_huge;
+		opts.populate = true;
+		opts.numa_node = 0;
+		auto buf = buf_t::create(SHM_PATH, SLOTSIZE, 3, opts);
+		auto rd = buf_t::connect(SHM_PATH, SLOTSIZE);
+		buf.push(frame.data());
+		CHECK(rd.pop()[SLOTSIZE - 1] == 3);
+		shm_unlink(SHM_PATH);
+	}
+	SECTION("file backed segment is found by connect"){
+		opts.pages = shmuf::Pages::huge;
+		opts.hugetlbfs = "/tmp"; // stands in for a hugetlbfs mount
+		buf_t::create(SHM_PATH, SLOTSIZE, 3); // stale segment in /dev/shm must not shadow the new one
+		auto buf = buf_t::create(SHM_PATH, SLOTSIZE, 5, opts);
+		CHECK_THROWS(buf_t::connect(SHM_PATH, SLOTSIZE));
+		CHECK_THROWS(buf_t::connect(SHM_PATH, SLOTSIZE + 1, opts));
+		auto rd = buf_t::connect(SHM_PATH, SLOTSIZE, opts);
+		CHECK(rd.nslots == 5);
+		buf.push(frame.data());
+		CHECK(rd.pop()[0] == 3);
+
+		opts.pages = shmuf::Pages::normal; // stale file backed segment is removed as well
+		buf_t::create(SHM_PATH, SLOTSIZE, 3, opts);
+		CHECK(access((std::string("/tmp") + SHM_PATH).c_str(), F_OK) == -1);
+		shm_unlink(SHM_PATH);
+	}
+	SECTION("bad numa node"){
+		opts.numa_node = 4096;
+		CHECK_THROWS(buf_t::create(SHM_PATH, SLOTSIZE, 3, opts));
+		shm_unlink(SHM_PATH);
+	}
+}
+
+TEST_CASE("slot layout", "[shmufbuf]"){
+	using buf_t = ShmufBuf<uint8_t[], shmuf::LockFree>;
+	auto is_aligned = [](const void* p, size_t align){ return reinterpret_cast<uintptr_t>(p) % align == 0; };
+
+	SECTION("slots are aligned to cache lines"){
+		auto buf = buf_t::create(SHM_PATH, 3);
+		CHECK(buf.header().version == detail::Header::layout_version);
+		CHECK(buf.slot_stride == 64);
+		CHECK(reinterpret_cast<char*>(&buf.control()) - buf.ptr.get() == 64);
+		for(size_t i = 0; i < 3; ++i){
+			CHECK(is_aligned(buf.acquire_write_slot(), 64));
+			buf.publish();
+		}
+	}
+	SECTION("slots are aligned to pages"){
+		auto opts = shmuf::Options{};
+		opts.slot_align = size_t(sysconf(_SC_PAGESIZE));
+		auto buf = buf_t::create(SHM_PATH, 100, 3, opts);
+		auto rd = buf_t::connect(SHM_PATH, 100);
+		CHECK(rd.slot_stride == opts.slot_align);
+		for(size_t i = 0; i < 3; ++i){
+			CHECK(is_aligned(buf.publish(), opts.slot_align));
+			CHECK(is_aligned(rd.pop(), opts.slot_align));
+		}
+		opts.slot_align = 100;
+		CHECK_THROWS(buf_t::create(SHM_PATH, 100, 3, opts));
+	}
+	SECTION("connect validates the layout"){
+		auto buf = buf_t::create(SHM_PATH, 64);
+		CHECK_THROWS(ShmufBuf<uint8_t[], shmuf::Locking<>>::connect(SHM_PATH, 64));
+		CHECK_NOTHROW(buf_t::connect(SHM_PATH, 64));
+	}
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("pollable notification", "[shmufbuf]"){
+	using buf_t = ShmufBuf<uint32_t, shmuf::LockFree>;
+	static const size_t CHANNELS = 3;
+	auto names = std::vector<std::string>{};
+	auto bufs = std::vector<buf_t>{};
+	for(size_t i = 0; i < CHANNELS; ++i){
+		names.push_back(SHM_PATH + std::to_string(i));
+		bufs.push_back(buf_t::create(names.back().c_str()));
+	}
+
+	auto epollfd = epoll_create1(0);
+	REQUIRE(epollfd != -1);
+	for(size_t i = 0; i < CHANNELS; ++i){
+		auto ev = epoll_event{};
+		ev.events = EPOLLIN;
+		ev.data.u64 = i;
+		REQUIRE(epoll_ctl(epollfd, EPOLL_CTL_ADD, bufs[i].notify_fd(), &ev) == 0);
+		CHECK(bufs[i].arm());
+	}
+
+	auto writer = run_forked([&]{
+		for(uint32_t val = 1; val <= 3*CHANNELS; ++val){
+			auto wr = buf_t::connect(names[val % CHANNELS].c_str());
+			wr.push(val);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+
+	auto got = std::vector<uint32_t>{};
+	auto events = std::array<epoll_event, CHANNELS>{};
+	auto last_seen = [&]{ // last value pushed to every channel is popped
+		return std::count_if(begin(got), end(got), [](uint32_t v){ return v > 2*CHANNELS; }) == CHANNELS;
+	};
+	while(!last_seen()){
+		const auto n = epoll_wait(epollfd, events.data(), int(events.size()), 5000);
+		REQUIRE(n > 0);
+		for(int e = 0; e < n; ++e){
+			auto& buf = bufs[events[size_t(e)].data.u64];
+			do {
+				while(auto p = buf.try_pop()){ got.push_back(*p); }
+			} while(!buf.arm());
+		}
+	}
+	CHECK(wait_exit(writer) == 0);
+	close(epollfd);
+	for(const auto& name: names){
+		shm_unlink(name.c_str());
+		unlink(("/dev/shm" + name + ".notify").c_str());
+	}
+	std::sort(begin(got), end(got));
+	CHECK(std::adjacent_find(begin(got), end(got)) == end(got)); // no value popped twice
+}
+
+TEST_CASE("lock-free handoff between processes", "[shmufbuf]"){
+	using buf_t = ShmufBuf<uint32_t[], shmuf::LockFree>;
+	CHECK_THROWS(buf_t::create(SHM_PATH, SLOTSIZE, 2)); // triple buffer needs 3 slots
+	auto buf = buf_t::create(SHM_PATH, SLOTSIZE);
+
+	auto writer = run_forked([&]{
+		auto wr = buf_t::connect(SHM_PATH, SLOTSIZE);
+		auto frame = std::vector<uint32_t>(SLOTSIZE);
+		for(uint32_t i = 1; i <= FRAMES; ++i){
+			std::fill(begin(frame), end(frame), i);
+			wr.push(frame.data());
+		}
+	});
+
+	auto torn = size_t{0};
+	for(auto last = uint32_t{0}; last != FRAMES; ){
+		auto p = buf.pop();
+		torn += size_t(std::count(p, p + SLOTSIZE, p[0]) != SLOTSIZE);
+		CHECK(p[0] > last); // never get the same or older frame twice
+		last = p[0];
+	}
+	CHECK(wait_exit(writer) == 0);
+	CHECK(torn == 0);
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("broadcast to many readers", "[shmufbuf]"){
+	using buf_t = ShmufBuf<uint32_t[], shmuf::Broadcast>;
+	auto wr = buf_t::create(SHM_PATH, SLOTSIZE, 4);
+	auto rd1 = buf_t::connect(SHM_PATH, SLOTSIZE);
+	auto rd2 = buf_t::connect(SHM_PATH, SLOTSIZE);
+	auto frame = std::vector<uint32_t>(SLOTSIZE);
+
+	SECTION("every reader gets the last frame"){
+		CHECK(rd1.try_pop() == nullptr);
+		for(uint32_t i = 1; i < 5; ++i){
+			std::fill(begin(frame), end(frame), i);
+			wr.push(frame.data());
+		}
+		CHECK(rd1.pop()[0] == 4);
+		CHECK(rd1.try_pop() == nullptr);
+		CHECK(!rd2.empty());
+		CHECK(rd2.pop()[0] == 4);
+		CHECK(rd2.empty());
+	}
+	SECTION("held slots are not overwritten"){
+		wr.push(frame.data());
+		auto p1 = rd1.pop();
+		std::fill(begin(frame), end(frame), 1u);
+		wr.push(frame.data());
+		auto p2 = rd2.pop();
+		CHECK(p1 != p2);
+		for(uint32_t i = 2; i < 100; ++i){
+			std::fill(begin(frame), end(frame), i);
+			wr.push(frame.data());
+		}
+		CHECK(std::count(p1, p1 + SLOTSIZE, 0u) == SLOTSIZE);
+		CHECK(std::count(p2, p2 + SLOTSIZE, 1u) == SLOTSIZE);
+		CHECK(rd1.pop()[0] == 99);
+	}
+	SECTION("number of readers is limited by number of slots"){
+		wr.push(frame.data());
+		rd1.pop();
+		rd2.pop();
+		auto rd3 = buf_t::connect(SHM_PATH, SLOTSIZE);
+		CHECK_THROWS(rd3.try_pop());
+		{ auto gone = std::move(rd2); }  // releases the cursor
+		CHECK(rd3.try_pop() != nullptr);
+	}
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("broadcast between processes", "[shmufbuf]"){
+	using buf_t = ShmufBuf<uint32_t[], shmuf::Broadcast>;
+	static const size_t READERS = 3;
+	auto wr = buf_t::create(SHM_PATH, SLOTSIZE, READERS + 2);
+
+	auto readers = std::vector<pid_t>{};
+	for(size_t r = 0; r < READERS; ++r){
+		readers.push_back(run_forked([&]{
+			auto rd = buf_t::connect(SHM_PATH, SLOTSIZE);
+			for(auto last = uint32_t{0}; last != FRAMES; ){
+				auto p = rd.pop();
+				if(std::count(p, p + SLOTSIZE, p[0]) != SLOTSIZE || p[0] <= last){
+					_exit(1);
+				}
+				last = p[0];
+			}
+		}));
+	}
+
+	auto frame = std::vector<uint32_t>(SLOTSIZE);
+	for(uint32_t i = 1; i <= FRAMES; ++i){
+		std::fill(begin(frame), end(frame), i);
+		wr.push(frame.data());
+	}
+	for(auto pid: readers){
+		CHECK(wait_exit(pid) == 0);
+	}
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("lossless queue", "[shmufbuf]"){
+	using buf_t = ShmufBuf<uint32_t[], shmuf::Queue>;
+	static const size_t NSLOTS = 8;
+	auto wr = buf_t::create(SHM_PATH, 2, NSLOTS);
+	auto rd = buf_t::connect(SHM_PATH, 2);
+
+	auto frames = [](uint32_t first, size_t n){
+		auto r = std::vector<uint32_t>{};
+		for(auto i = first; i < first + n; ++i){ r.insert(end(r), {i, i}); }
+		return r;
+	};
+
+	SECTION("every frame is kept"){
+		CHECK(rd.try_pop() == nullptr);
+		for(uint32_t i = 0; i < NSLOTS; ++i){
+			wr.push(frames(i, 1).data());
+		}
+		for(uint32_t i = 0; i < NSLOTS; ++i){
+			auto p = rd.pop();
+			CHECK(p[0] == i);
+			CHECK(p[1] == i);
+		}
+		CHECK(rd.try_pop() == nullptr);
+		CHECK(rd.empty());
+	}
+	SECTION("batches wrap around the ring"){
+		auto out = std::vector<uint32_t>(2*NSLOTS);
+		for(uint32_t round = 0; round < 5; ++round){
+			const auto in = frames(round*5, 5);
+			wr.push_n(in.data(), 5);
+			CHECK(!rd.empty());
+			CHECK(rd.pop_n(out.data(), 3) == 3);
+			CHECK(rd.pop_n(out.data() + 6, NSLOTS) == 2);
+			CHECK(std::equal(begin(in), end(in), begin(out)));
+		}
+		CHECK(rd.empty());
+	}
+	SECTION("held slot is not overwritten"){
+		wr.push(frames(1, 1).data());
+		auto p = rd.pop();
+		wr.push_n(frames(2, NSLOTS - 1).data(), NSLOTS - 1);
+		CHECK(p[0] == 1);
+		CHECK(rd.pop()[0] == 2);
+	}
+	SECTION("batches after in-place writes are not taken for torn"){
+		auto slot = wr.acquire_write_slot();
+		std::fill_n(slot, 2, 1u);
+		wr.publish(); // opens the next slot for writing
+		wr.push_n(frames(2, 2).data(), 2);
+		CHECK(rd.pop()[0] == 1);
+		CHECK(rd.pop()[0] == 2);
+		CHECK(rd.pop()[0] == 3);
+		slot = wr.acquire_write_slot();
+		std::fill_n(slot, 2, 4u);
+		wr.publish();
+		wr.push_n(frames(5, 2).data(), 2);
+		auto out = std::vector<uint32_t>(2*NSLOTS);
+		CHECK(rd.pop_n(out.data(), NSLOTS) == 3);
+		CHECK(out[0] == 4);
+		CHECK(out[4] == 6);
+	}
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("deep buffers", "[shmufbuf]"){
+	SECTION("byte indices are limited to 254 slots"){
+		CHECK_THROWS(ShmufBuf<uint32_t, shmuf::Locking<>>::create(SHM_PATH, 255));
+	}
+	SECTION("wide indices"){
+		using buf_t = ShmufBuf<uint32_t, shmuf::Locking<uint16_t>>;
+		auto wr = buf_t::create(SHM_PATH, 1000);
+		auto rd = buf_t::connect(SHM_PATH);
+		CHECK(rd.nslots == 1000);
+		CHECK_THROWS(ShmufBuf<uint32_t, shmuf::Locking<>>::connect(SHM_PATH)); // index width mismatch
+		for(uint32_t i = 0; i < 3000; ++i){
+			wr.push(i);
+			if(i % 7 == 0){ CHECK(rd.pop() == i); }
+		}
+		CHECK(rd.pop() == 2999);
+	}
+	SECTION("queue runs thousands of slots ahead"){
+		using buf_t = ShmufBuf<uint32_t[], shmuf::Queue>;
+		static const size_t DEPTH = 5000;
+		auto wr = buf_t::create(SHM_PATH, 1, DEPTH);
+		auto rd = buf_t::connect(SHM_PATH, 1);
+		auto in = std::vector<uint32_t>(DEPTH);
+		std::iota(begin(in), end(in), 0u);
+		wr.push_n(in.data(), DEPTH);
+		auto out = std::vector<uint32_t>(DEPTH);
+		CHECK(rd.pop_n(out.data(), DEPTH) == DEPTH);
+		CHECK(out == in);
+	}
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("queue between processes", "[shmufbuf]"){
+	using buf_t = ShmufBuf<uint32_t[], shmuf::Queue>;
+	auto rd = buf_t::create(SHM_PATH, SLOTSIZE, 16);
+
+	auto writer = run_forked([&]{
+		auto wr = buf_t::connect(SHM_PATH, SLOTSIZE);
+		auto batch = std::vector<uint32_t>(7*SLOTSIZE);
+		for(uint32_t i = 0; i < FRAMES; ){
+			const auto n = std::min(size_t(1 + i%7), size_t(FRAMES - i));
+			for(size_t k = 0; k < n; ++k, ++i){
+				std::fill_n(begin(batch) + ptrdiff_t(k*SLOTSIZE), SLOTSIZE, i);
+			}
+			wr.push_n(batch.data(), n);
+		}
+	});
+
+	auto out = std::vector<uint32_t>(5*SLOTSIZE);
+	auto lost = size_t{0};
+	for(uint32_t i = 0; i < FRAMES; ){
+		const auto n = rd.pop_n(out.data(), 5);
+		for(size_t k = 0; k < n; ++k, ++i){
+			lost += size_t(std::count(begin(out) + ptrdiff_t(k*SLOTSIZE), begin(out) + ptrdiff_t((k + 1)*SLOTSIZE), i)
+			               != SLOTSIZE);
+		}
+	}
+	CHECK(lost == 0);
+	CHECK(wait_exit(writer) == 0);
+	CHECK(rd.empty());
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("seqlock readers", "[shmufbuf]"){
+	using buf_t = ShmufBuf<frame_t, shmuf::Seqlock>;
+	auto wr = buf_t::create(SHM_PATH, 2);
+	auto rd1 = buf_t::connect(SHM_PATH);
+	auto rd2 = buf_t::connect(SHM_PATH);
+	auto out = frame_t{};
+	CHECK_FALSE(rd1.try_load(out));
+	CHECK(rd1.empty());
+
+	wr.push(frame_t{1, 1, 1, 1});
+	wr.push(frame_t{2, 2, 2, 2});
+	CHECK(rd1.try_load(out));
+	CHECK(out == (frame_t{2, 2, 2, 2}));
+	CHECK_FALSE(rd1.try_load(out));
+	rd2.load(out);
+	CHECK(out == (frame_t{2, 2, 2, 2}));
+
+	auto slot = wr.acquire_write_slot();
+	*slot = frame_t{3, 3, 3, 3};
+	CHECK(rd1.empty());
+	wr.publish();
+	rd1.load(out);
+	CHECK(out == (frame_t{3, 3, 3, 3}));
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("seqlock readers between processes", "[shmufbuf]"){
+	using buf_t = ShmufBuf<uint32_t[], shmuf::Seqlock>;
+	auto wr = buf_t::create(SHM_PATH, SLOTSIZE, 2);
+	auto readers = std::vector<pid_t>{};
+	for(int r = 0; r < 3; ++r){
+		readers.push_back(run_forked([&]{
+			auto rd = buf_t::connect(SHM_PATH, SLOTSIZE);
+			auto out = std::array<uint32_t, SLOTSIZE>{};
+			auto prev = uint32_t{0};
+			do {
+				rd.load(out.data());
+				if(std::count(begin(out), end(out), out[0]) != SLOTSIZE || out[0] <= prev){
+					_exit(1); // torn or stale frame
+				}
+				prev = out[0];
+			} while(prev != FRAMES);
+		}));
+	}
+
+	auto frame = std::array<uint32_t, SLOTSIZE>{};
+	for(uint32_t i = 1; i <= FRAMES; ++i){
+		frame.fill(i);
+		wr.push(frame.data());
+	}
+	for(auto pid: readers){
+		CHECK(wait_exit(pid) == 0);
+	}
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("writer crash recovery", "[shmufbuf]"){
+	using buf_t = ShmufBuf<uint32_t[]>;
+	auto opts = shmuf::Options{};
+	opts.reattach = true;
+	auto rd = buf_t::create(SHM_PATH, SLOTSIZE, 3);
+
+	auto crashed = run_forked([&]{
+		auto wr = buf_t::connect(SHM_PATH, SLOTSIZE);
+		auto frame = std::array<uint32_t, SLOTSIZE>{};
+		for(uint32_t i = 0; i < 5; ++i){
+			frame.fill(i);
+			wr.push(frame.data());
+		}
+		auto slot = wr.acquire_write_slot();
+		std::fill_n(slot, SLOTSIZE/2, 42u);
+		_exit(0); // dies in the middle of the frame
+	});
+	CHECK(wait_exit(crashed) == 0);
+	CHECK_FALSE(rd.writer_alive());
+
+	auto out = rd.try_pop();
+	REQUIRE(out);
+	CHECK(std::count(out, out + SLOTSIZE, 4u) == SLOTSIZE);
+
+	SECTION("reattach keeps the data and allows new writer"){
+		auto wr = buf_t::create(SHM_PATH, SLOTSIZE, 3, opts);
+		auto slot = wr.acquire_write_slot();
+		CHECK(wr.torn(slot));
+		std::fill_n(slot, SLOTSIZE, 5u);
+		wr.publish();
+		CHECK(rd.writer_alive());
+		out = rd.try_pop();
+		REQUIRE(out);
+		CHECK_FALSE(rd.torn(out));
+		CHECK(std::count(out, out + SLOTSIZE, 5u) == SLOTSIZE);
+	}
+	SECTION("only one live writer"){
+		auto frame = std::array<uint32_t, SLOTSIZE>{};
+		auto wr = buf_t::connect(SHM_PATH, SLOTSIZE);
+		wr.push(frame.data());
+		auto other = run_forked([&]{
+			auto wr2 = buf_t::connect(SHM_PATH, SLOTSIZE);
+			try {
+				wr2.push(frame.data());
+			} catch(std::runtime_error&){
+				_exit(0);
+			}
+			_exit(1);
+		});
+		CHECK(wait_exit(other) == 0);
+		auto recreate = run_forked([&]{
+			try {
+				buf_t::create(SHM_PATH, SLOTSIZE, 3, opts);
+			} catch(std::runtime_error&){
+				_exit(0);
+			}
+			_exit(1);
+		});
+		CHECK(wait_exit(recreate) == 0);
+	}
+	SECTION("writer is released with its handle"){
+		auto frame = std::array<uint32_t, SLOTSIZE>{};
+		{
+			auto wr = buf_t::connect(SHM_PATH, SLOTSIZE);
+			wr.push(frame.data());
+			auto inherited = run_forked([&]{ // child of a writer is a different writer
+				try {
+					wr.push(frame.data());
+				} catch(std::runtime_error&){
+					_exit(0);
+				}
+				_exit(1);
+			});
+			CHECK(wait_exit(inherited) == 0);
+		}
+		auto other = run_forked([&]{
+			auto wr2 = buf_t::connect(SHM_PATH, SLOTSIZE);
+			wr2.push(frame.data());
+			_exit(0);
+		});
+		CHECK(wait_exit(other) == 0);
+	}
+	SECTION("incompatible layout is recreated"){
+		auto wr = buf_t::create(SHM_PATH, SLOTSIZE, 5, opts);
+		CHECK(wr.nslots == 5);
+		CHECK(wr.try_pop() == nullptr);
+	}
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("lock-free writer crash in the middle of publish", "[shmufbuf]"){
+	using buf_t = ShmufBuf<frame_t, shmuf::LockFree>;
+	auto opts = shmuf::Options{};
+	opts.reattach = true;
+	auto rd = buf_t::create(SHM_PATH);
+
+	auto crashed = run_forked([&]{
+		auto wr = buf_t::connect(SHM_PATH);
+		wr.push(make_frame(1));
+		wr.push(make_frame(2));
+		// hand the slot over as publish() does, then die before taking the previous latest slot
+		const auto len = sizeof(detail::Header) + sizeof(detail::AtomicControlBlock);
+		const auto fd = shm_open(SHM_PATH, O_RDWR, 0);
+		auto p = static_cast<char*>(mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+		auto& cb = *reinterpret_cast<detail::AtomicControlBlock*>(p + sizeof(detail::Header));
+		cb.latest.exchange(cb.wr_cur | detail::AtomicControlBlock::fresh);
+		_exit(0);
+	});
+	CHECK(wait_exit(crashed) == 0);
+
+	auto wr = buf_t::create(SHM_PATH, 3, opts);
+	wr.push(make_frame(3));
+	auto p = rd.try_pop();
+	REQUIRE(p != nullptr);
+	CHECK(*p == make_frame(3));
+	wr.push(make_frame(4));
+	CHECK(*p == make_frame(3)); // writer does not touch the slot being read
+	CHECK(rd.pop() == make_frame(4));
+	shm_unlink(SHM_PATH);
+}
+
+TEST_CASE("slots of dead readers are reclaimed", "[shmufbuf]"){
+	using buf_t = ShmufBuf<uint32_t, shmuf::Broadcast>;
+	auto wr = buf_t::create(SHM_PATH, 4);
+	wr.push(1);
+	for(size_t i = 0; i < detail::BroadcastControlBlock::max_readers + 1; ++i){
+		auto reader = run_forked([&]{
+			auto rd = buf_t::connect(SHM_PATH);
+			auto out = rd.try_pop();
+			_exit(out && *out == 1 ? 0 : 1); // leaves without releasing the cursor
+		});
+		CHECK(wait_exit(reader) == 0);
+	}
+	auto rd = buf_t::connect(SHM_PATH);
+	auto out = rd.try_pop();
+	REQUIRE(out);
+	CHECK(*out == 1);
+	shm_unlink(SHM_PATH);
+}
+
+int main( int argc, char* argv[] )
+{
+	// global setup...
+	int result = Catch::Session().run( argc, argv );
+	// global clean-up...
+	return ( result < 0xff ? result : 0xff );
+}